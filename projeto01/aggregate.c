@@ -0,0 +1,352 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "aggregate.h"
+#include "request.h"
+#include "when_macros.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Slots of a table when its first key is counted, a power of two
+#define AGGREGATE_INITIAL_CAPACITY 64
+// Room for a year written in decimal
+#define YEAR_MAX_LEN 12
+
+struct counter {
+  char *key; // NULL if the slot is free
+  size_t len;
+  long count;
+};
+
+struct counter_table {
+  struct counter *slots;
+  size_t capacity; // Power of two
+  size_t used;
+};
+
+static const char *DIMENSION_NAMES[AGGREGATE_DIMENSIONS] = {
+    [AGGREGATE_GENRE] = "genre",
+    [AGGREGATE_YEAR] = "year",
+    [AGGREGATE_DIRECTOR] = "director",
+};
+
+static struct {
+  pthread_mutex_t lock;
+  struct counter_table tables[AGGREGATE_DIMENSIONS];
+} aggregate = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static inline size_t hash_key(const char *key, size_t len) {
+  // FNV-1a over the bytes of the key
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char)key[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static struct counter *find_slot(struct counter *slots, size_t capacity,
+                                 const char *key, size_t len) {
+  size_t mask = capacity - 1;
+  for (size_t i = hash_key(key, len) & mask;; i = (i + 1) & mask) {
+    struct counter *slot = &slots[i];
+    if (slot->key == NULL ||
+        (slot->len == len && memcmp(slot->key, key, len) == 0))
+      return slot;
+  }
+}
+
+static int grow(struct counter_table *table) {
+  size_t capacity = table->capacity ? table->capacity * 2
+                                    : AGGREGATE_INITIAL_CAPACITY;
+  struct counter *slots = calloc(capacity, sizeof(struct counter));
+  when_null_ret(slots, -1, "ERROR: Failed to grow aggregate counters\n");
+  for (size_t i = 0; i < table->capacity; i++) {
+    struct counter *old = &table->slots[i];
+    if (old->key != NULL)
+      *find_slot(slots, capacity, old->key, old->len) = *old;
+  }
+  free(table->slots);
+  table->slots = slots;
+  table->capacity = capacity;
+  return 0;
+}
+
+// Add delta to the counter of key, with aggregate.lock held. Keys are never
+// removed nor freed, a group whose films are all gone stays with a zero
+// count.
+static void count_key(aggregate_dimension_e dimension, const char *key,
+                      size_t len, int delta) {
+  struct counter_table *table = &aggregate.tables[dimension];
+  // Keep the load factor under 70%
+  if ((table->used + 1) * 10 > table->capacity * 7 && 0 != grow(table))
+    return;
+  struct counter *slot = find_slot(table->slots, table->capacity, key, len);
+  if (slot->key == NULL) {
+    char *copy = malloc(len + 1);
+    if (copy == NULL) {
+      fprintf(stderr, "ERROR: Failed to allocate aggregate key\n");
+      return;
+    }
+    memcpy(copy, key, len);
+    copy[len] = '\0';
+    *slot = (struct counter){.key = copy, .len = len, .count = 0};
+    table->used++;
+  }
+  slot->count += delta;
+}
+
+// Get the next genre of a comma separated list without its surrounding
+// spaces, skipping the empty ones
+static int next_genre(string_tokenizer_t *tokenizer, string_t *genre) {
+  while (string_tokenize(tokenizer, ',', genre)) {
+    while (genre->len > 0 && genre->str[0] == ' ') {
+      genre->str++;
+      genre->len--;
+    }
+    while (genre->len > 0 && genre->str[genre->len - 1] == ' ')
+      genre->len--;
+    if (genre->len > 0)
+      return 1;
+  }
+  return 0;
+}
+
+// Does the list hold the genre before the position until (NULL for anywhere)
+static int has_genre(string_t list, string_t genre, const char *until) {
+  string_tokenizer_t tokenizer;
+  string_t other;
+  string_tokenizer_init(&tokenizer, list);
+  while (next_genre(&tokenizer, &other) &&
+         (until == NULL || other.str < until)) {
+    if (other.len == genre.len && memcmp(other.str, genre.str, genre.len) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+// Count delta for each distinct genre of list that is missing from except
+static void count_genres(string_t list, string_t except, int delta) {
+  string_tokenizer_t tokenizer;
+  string_t genre;
+  string_tokenizer_init(&tokenizer, list);
+  while (next_genre(&tokenizer, &genre)) {
+    if (!has_genre(list, genre, genre.str) && !has_genre(except, genre, NULL))
+      count_key(AGGREGATE_GENRE, genre.str, genre.len, delta);
+  }
+}
+
+static void count_film(string_t genres, string_t director, int year,
+                       int delta) {
+  char key[YEAR_MAX_LEN];
+  int len = snprintf(key, sizeof(key), "%d", year);
+  count_genres(genres, EMPTY_STRING, delta);
+  count_key(AGGREGATE_YEAR, key, len, delta);
+  count_key(AGGREGATE_DIRECTOR, director.str, director.len, delta);
+}
+
+static string_t column_view(sqlite3_stmt *stmt, int column) {
+  string_t view;
+  const char *text = (const char *)sqlite3_column_text(stmt, column);
+  string_init_view(&view, text, text ? strlen(text) : 0);
+  return view;
+}
+
+int aggregate_rebuild(sqlite3 *db) {
+  sqlite3_stmt *stmt;
+  int rc = sqlite3_prepare_v2(db, "SELECT genre, director, year FROM films",
+                              -1, &stmt, NULL);
+  when_false_ret(SQLITE_OK == rc, -1, "Failed to prepare the request: %s\n",
+                 sqlite3_errmsg(db));
+  pthread_mutex_lock(&aggregate.lock);
+  while (SQLITE_ROW == (rc = sqlite3_step(stmt)))
+    count_film(column_view(stmt, 0), column_view(stmt, 1),
+               sqlite3_column_int(stmt, 2), 1);
+  pthread_mutex_unlock(&aggregate.lock);
+  sqlite3_finalize(stmt);
+  when_false_ret(SQLITE_DONE == rc, -1, "Failed to evaluate the request: %s\n",
+                 sqlite3_errmsg(db));
+  return 0;
+}
+
+static char *copy_string(string_t string) {
+  char *copy = malloc(string.len + 1);
+  when_null_ret(copy, NULL, "ERROR: Failed to stage aggregate change\n");
+  if (string.len > 0)
+    memcpy(copy, string.str, string.len);
+  copy[string.len] = '\0';
+  return copy;
+}
+
+void aggregate_stage_film(aggregate_change_t *change, const film_t *film,
+                          int delta) {
+  aggregate_discard(change);
+  change->genres = copy_string(film->genre);
+  change->director = copy_string(film->director);
+  change->year = film->year;
+  if (change->genres != NULL && change->director != NULL)
+    change->delta = delta;
+}
+
+void aggregate_stage_genres(aggregate_change_t *change, string_t old_genres,
+                            string_t new_genres) {
+  aggregate_discard(change);
+  change->old_genres = copy_string(old_genres);
+  change->genres = copy_string(new_genres);
+}
+
+void aggregate_apply(aggregate_change_t *change) {
+  string_t genres, old_genres, director;
+  string_init_view(&genres, change->genres,
+                   change->genres ? strlen(change->genres) : 0);
+  string_init_view(&old_genres, change->old_genres,
+                   change->old_genres ? strlen(change->old_genres) : 0);
+  string_init_view(&director, change->director,
+                   change->director ? strlen(change->director) : 0);
+  pthread_mutex_lock(&aggregate.lock);
+  if (change->delta != 0) {
+    count_film(genres, director, change->year, change->delta);
+  } else if (change->genres != NULL && change->old_genres != NULL) {
+    count_genres(genres, old_genres, 1);
+    count_genres(old_genres, genres, -1);
+  }
+  pthread_mutex_unlock(&aggregate.lock);
+  aggregate_discard(change);
+}
+
+void aggregate_discard(aggregate_change_t *change) {
+  free(change->genres);
+  free(change->old_genres);
+  free(change->director);
+  *change = (aggregate_change_t)AGGREGATE_CHANGE_INIT;
+}
+
+int aggregate_parse_dimension(string_t name, aggregate_dimension_e *dimension) {
+  for (int i = 0; i < AGGREGATE_DIMENSIONS; i++) {
+    if (strlen(DIMENSION_NAMES[i]) == name.len &&
+        memcmp(DIMENSION_NAMES[i], name.str, name.len) == 0) {
+      *dimension = i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// Largest count first, then by key for a stable order
+static int compare_ranks(const struct counter *left,
+                         const struct counter *right) {
+  if (left->count != right->count)
+    return left->count < right->count ? 1 : -1;
+  size_t len = left->len < right->len ? left->len : right->len;
+  int order = memcmp(left->key, right->key, len);
+  if (order != 0)
+    return order;
+  return (left->len > right->len) - (left->len < right->len);
+}
+
+static int compare_counters(const void *a, const void *b) {
+  return compare_ranks(*(const struct counter *const *)a,
+                       *(const struct counter *const *)b);
+}
+
+// Restore a heap whose root is the group ranked last, from position i
+static void sift_down(const struct counter **heap, size_t len, size_t i) {
+  while (1) {
+    size_t last = i, left = 2 * i + 1, right = left + 1;
+    if (left < len && compare_ranks(heap[left], heap[last]) > 0)
+      last = left;
+    if (right < len && compare_ranks(heap[right], heap[last]) > 0)
+      last = right;
+    if (last == i)
+      return;
+    const struct counter *swap = heap[i];
+    heap[i] = heap[last];
+    heap[last] = swap;
+    i = last;
+  }
+}
+
+// Move the k first ranked groups to the front, in O(len log k). Sorting
+// them all is cheaper when k is more than a small share of the groups.
+static size_t select_top(const struct counter **groups, size_t len,
+                         size_t k) {
+  if (k >= len / 8)
+    return len;
+  for (size_t i = k / 2; i > 0; i--)
+    sift_down(groups, k, i - 1);
+  for (size_t i = k; i < len; i++) {
+    if (compare_ranks(groups[i], groups[0]) < 0) {
+      groups[0] = groups[i];
+      sift_down(groups, k, 0);
+    }
+  }
+  return k;
+}
+
+size_t aggregate_groups(aggregate_dimension_e dimension) {
+  pthread_mutex_lock(&aggregate.lock);
+  size_t groups = aggregate.tables[dimension].used;
+  pthread_mutex_unlock(&aggregate.lock);
+  return groups;
+}
+
+int aggregate_encode(aggregate_dimension_e dimension, unsigned top,
+                     string_t *body, int *count) {
+  *count = 0;
+  // Copy the counters, whose keys are never freed, then rank them without
+  // holding the lock the writes take to apply their changes
+  pthread_mutex_lock(&aggregate.lock);
+  struct counter_table *table = &aggregate.tables[dimension];
+  size_t used = table->used + 1;
+  struct counter *copies = malloc(used * (sizeof(struct counter) +
+                                          sizeof(struct counter *)));
+  const struct counter **groups = (const struct counter **)(copies + used);
+  size_t len = 0, shortest = SIZE_MAX;
+  for (size_t i = 0; copies != NULL && i < table->capacity; i++) {
+    if (table->slots[i].key != NULL && table->slots[i].count > 0) {
+      copies[len] = table->slots[i];
+      groups[len] = &copies[len];
+      if (copies[len].len < shortest)
+        shortest = copies[len].len;
+      len++;
+    }
+  }
+  pthread_mutex_unlock(&aggregate.lock);
+  when_null_ret(copies, -1, "ERROR: Failed to allocate aggregate groups\n");
+  // A record takes its key, a separator, a digit and the record separator:
+  // no more records than that fit in a body are ranked
+  size_t limit = len > 0 ? RESPONSE_BODY_MAX / (shortest + 3) + 1 : 0;
+  if (top != 0 && top < limit)
+    limit = top;
+  len = select_top(groups, len, limit);
+  qsort(groups, len, sizeof(*groups), compare_counters);
+  if (len > limit)
+    len = limit;
+
+  // Records are joined by the record separator, within a response body that
+  // leaves room for the null byte written by snprintf
+  size_t size = 0;
+  for (size_t i = 0; i < len; i++) {
+    char number[24];
+    int number_len = snprintf(number, sizeof(number), "%ld", groups[i]->count);
+    size_t record_len = groups[i]->len + 1 + number_len;
+    if (size + (i > 0) + record_len >= RESPONSE_BODY_MAX)
+      break;
+    size += (i > 0) + record_len;
+  }
+  char *buffer = string_reserve(body, size);
+  if (buffer != NULL) {
+    char *cursor = buffer;
+    for (size_t written = 0; (size_t)(cursor - buffer) < size; written++) {
+      if (written > 0)
+        *cursor++ = '\x1E';
+      cursor += snprintf(cursor, size + 1 - (cursor - buffer), "%s\x1F%ld",
+                         groups[written]->key, groups[written]->count);
+      (*count)++;
+    }
+  }
+  free(copies);
+  when_null_ret(buffer, -1, "ERROR: Failed to allocate aggregate body\n");
+  return 0;
+}
@@ -0,0 +1,64 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include "film.h"
+#include "string.h"
+#include <sqlite3.h>
+#include <stdint.h>
+
+/**
+ * @file aggregate.h
+ * @brief Counts of films by genre, year and director
+ * The counters are built from the films table at startup, then kept up to
+ * date by the writes: a write stages its change while its statements are
+ * alive, and applies it once committed. A film counts once for each
+ * distinct genre of its comma separated list. Answering copies the groups
+ * of a dimension, then ranks them without blocking the writes, and never
+ * reads the films table.
+ */
+
+enum aggregate_dimension : uint16_t {
+  AGGREGATE_GENRE,
+  AGGREGATE_YEAR,
+  AGGREGATE_DIRECTOR,
+  AGGREGATE_DIMENSIONS,
+};
+
+typedef enum aggregate_dimension aggregate_dimension_e;
+
+typedef struct aggregate_change aggregate_change_t;
+
+/**
+ * @struct aggregate_change
+ * @brief Change of the counters by a write, owning copies of its keys
+ */
+struct aggregate_change {
+  int delta;        /**< 1 for a new film, -1 for a removed one, else 0 */
+  char *genres;     /**< Genres of the film, or after the change */
+  char *old_genres; /**< Genres before the change */
+  char *director;   /**< Director of the added or removed film */
+  int year;         /**< Year of the added or removed film */
+};
+
+#define AGGREGATE_CHANGE_INIT {0, NULL, NULL, NULL, 0}
+
+int aggregate_rebuild(sqlite3 *db);
+
+void aggregate_stage_film(aggregate_change_t *change, const film_t *film,
+                          int delta);
+
+void aggregate_stage_genres(aggregate_change_t *change, string_t old_genres,
+                            string_t new_genres);
+
+void aggregate_apply(aggregate_change_t *change);
+
+void aggregate_discard(aggregate_change_t *change);
+
+int aggregate_parse_dimension(string_t name, aggregate_dimension_e *dimension);
+
+size_t aggregate_groups(aggregate_dimension_e dimension);
+
+int aggregate_encode(aggregate_dimension_e dimension, unsigned top,
+                     string_t *body, int *count);
+
+#endif // !AGGREGATE_H
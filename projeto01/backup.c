@@ -0,0 +1,192 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "backup.h"
+#include "when_macros.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sqlite3.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Progress is logged each time another BACKUP_LOG_PERCENT of pages is copied
+#define BACKUP_LOG_PERCENT 25
+
+struct backup_job {
+  char source[BACKUP_PATH_MAX_LEN];
+  char path[BACKUP_PATH_MAX_LEN];
+  unsigned interval_s; // Delay between two backups, 0 for a single one
+};
+
+static struct {
+  pthread_mutex_t lock;
+  backup_progress_t progress;
+} backup = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// Requests being executed, which backups yield to
+static atomic_uint in_flight;
+
+void backup_request_started(void) { atomic_fetch_add(&in_flight, 1); }
+
+void backup_request_finished(void) { atomic_fetch_sub(&in_flight, 1); }
+
+static void sleep_ms(unsigned ms) {
+  struct timespec delay = {ms / 1000, (ms % 1000) * 1000000L};
+  while (-1 == nanosleep(&delay, &delay) && errno == EINTR)
+    ;
+}
+
+// Reserve the progress for a backup to path, fails if one is running
+static int claim(const char *path) {
+  pthread_mutex_lock(&backup.lock);
+  if (backup.progress.running) {
+    pthread_mutex_unlock(&backup.lock);
+    return -1;
+  }
+  backup.progress = (backup_progress_t){.running = 1};
+  strcpy(backup.progress.path, path);
+  pthread_mutex_unlock(&backup.lock);
+  return 0;
+}
+
+static void report(int copied, int total) {
+  pthread_mutex_lock(&backup.lock);
+  backup.progress.copied = copied;
+  backup.progress.total = total;
+  pthread_mutex_unlock(&backup.lock);
+}
+
+static void release(int failed) {
+  pthread_mutex_lock(&backup.lock);
+  backup.progress.running = 0;
+  backup.progress.failed = failed;
+  pthread_mutex_unlock(&backup.lock);
+}
+
+static int copy_database(const char *source, const char *path) {
+  sqlite3 *src = NULL, *dst = NULL;
+  sqlite3_backup *copy;
+  char tmp_path[BACKUP_PATH_MAX_LEN + 4];
+  int pages = BACKUP_PAGES_PER_STEP, remaining = -1, logged = -1;
+  int rc, copied, total;
+
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+  rc = sqlite3_open_v2(source, &src, SQLITE_OPEN_READONLY, NULL);
+  when_false_jmp(SQLITE_OK == rc, error, "ERROR: Cannot open database: %s\n",
+                 sqlite3_errmsg(src));
+  rc = sqlite3_open_v2(tmp_path, &dst,
+                       SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+  when_false_jmp(SQLITE_OK == rc, error, "ERROR: Cannot open backup: %s\n",
+                 sqlite3_errmsg(dst));
+  copy = sqlite3_backup_init(dst, "main", src, "main");
+  when_null_jmp(copy, error, "ERROR: Cannot start backup: %s\n",
+                sqlite3_errmsg(dst));
+
+  fprintf(stderr, "INFO: Backup to %s started\n", path);
+  do {
+    rc = sqlite3_backup_step(copy, pages);
+    total = sqlite3_backup_pagecount(copy);
+    // A write through another connection restarts the copy: take bigger
+    // steps to have a chance to finish between two writes
+    if (remaining >= 0 && sqlite3_backup_remaining(copy) > remaining &&
+        pages < total)
+      pages *= 2;
+    remaining = sqlite3_backup_remaining(copy);
+    copied = total - remaining;
+    report(copied, total);
+    if (total > 0 && copied * 100 / total / BACKUP_LOG_PERCENT != logged) {
+      logged = copied * 100 / total / BACKUP_LOG_PERCENT;
+      fprintf(stderr, "INFO: Backup to %s: %d/%d pages\n", path, copied,
+              total);
+    }
+    if (rc != SQLITE_DONE)
+      sleep_ms(BACKUP_PAUSE_MS +
+               BACKUP_PAUSE_PER_REQUEST_MS * atomic_load(&in_flight));
+  } while (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED);
+  sqlite3_backup_finish(copy);
+  when_false_jmp(SQLITE_DONE == rc, error, "ERROR: Backup to %s failed: %s\n",
+                 path, sqlite3_errstr(rc));
+  sqlite3_close(src);
+  src = NULL;
+  rc = sqlite3_close(dst);
+  dst = NULL;
+  when_false_jmp(SQLITE_OK == rc, error, "ERROR: Cannot close backup %s\n",
+                 tmp_path);
+  // Replace the previous backup only with a complete one
+  when_false_jmp(0 == rename(tmp_path, path), error,
+                 "ERROR: Cannot move backup to %s: %s\n", path,
+                 strerror(errno));
+  fprintf(stderr, "INFO: Backup to %s done\n", path);
+  return 0;
+error:
+  sqlite3_close(src);
+  sqlite3_close(dst);
+  return -1;
+}
+
+static void *run_backup(void *arg) {
+  struct backup_job *job = arg;
+  release(copy_database(job->source, job->path));
+  free(job);
+  return NULL;
+}
+
+static void *run_periodic_backup(void *arg) {
+  struct backup_job *job = arg;
+  while (1) {
+    sleep(job->interval_s);
+    if (0 != claim(job->path)) {
+      fprintf(stderr, "WARNING: Backup still running, period skipped\n");
+      continue;
+    }
+    release(copy_database(job->source, job->path));
+  }
+  return NULL;
+}
+
+static int spawn(void *(*run)(void *), const char *source, const char *path,
+                 unsigned interval_s) {
+  pthread_t thread;
+  struct backup_job *job;
+  when_true_ret(strlen(source) >= BACKUP_PATH_MAX_LEN ||
+                    strlen(path) >= BACKUP_PATH_MAX_LEN,
+                -1, "ERROR: Backup path too long\n");
+  job = malloc(sizeof(struct backup_job));
+  when_null_ret(job, -1, "ERROR: Failed to allocate backup\n");
+  strcpy(job->source, source);
+  strcpy(job->path, path);
+  job->interval_s = interval_s;
+  if (0 != pthread_create(&thread, NULL, run, job)) {
+    fprintf(stderr, "ERROR: Failed to start backup thread\n");
+    free(job);
+    return -1;
+  }
+  pthread_detach(thread);
+  return 0;
+}
+
+int backup_start(const char *source, const char *path) {
+  when_true_ret(strlen(path) >= BACKUP_PATH_MAX_LEN, -1,
+                "ERROR: Backup path too long\n");
+  if (0 != claim(path))
+    return 0; // Already running: the caller follows its progress
+  if (0 != spawn(run_backup, source, path, 0)) {
+    release(1);
+    return -1;
+  }
+  return 0;
+}
+
+int backup_start_periodic(const char *source, const char *path,
+                          unsigned interval_s) {
+  return spawn(run_periodic_backup, source, path, interval_s);
+}
+
+void backup_progress(backup_progress_t *progress) {
+  pthread_mutex_lock(&backup.lock);
+  *progress = backup.progress;
+  pthread_mutex_unlock(&backup.lock);
+}
@@ -0,0 +1,49 @@
+#ifndef BACKUP_H
+#define BACKUP_H
+
+#include <stdint.h>
+
+/**
+ * @file backup.h
+ * @brief Online backups of the database
+ * A backup copies the database with the incremental SQLite backup API, a
+ * few pages at a time, into a temporary file renamed over the destination
+ * once complete. Locks are only held during a step, and the pause between
+ * two steps grows with the number of requests being executed, so that
+ * foreground requests keep their latency. A single backup runs at a time,
+ * in its own thread.
+ */
+
+#define BACKUP_PAGES_PER_STEP 64
+// Pause between two steps, plus BACKUP_PAUSE_PER_REQUEST_MS per request in
+// flight
+#define BACKUP_PAUSE_MS 2
+#define BACKUP_PAUSE_PER_REQUEST_MS 10
+#define BACKUP_PATH_MAX_LEN 1024
+
+/**
+ * @struct backup_progress
+ * @brief State of the last started backup
+ */
+struct backup_progress {
+  int running;                    /**< Is a backup being copied */
+  int failed;                     /**< Did the last backup fail */
+  int copied;                     /**< Pages copied so far */
+  int total;                      /**< Pages of the database */
+  char path[BACKUP_PATH_MAX_LEN]; /**< Destination of the backup */
+};
+
+typedef struct backup_progress backup_progress_t;
+
+int backup_start(const char *source, const char *path);
+
+int backup_start_periodic(const char *source, const char *path,
+                          unsigned interval_s);
+
+void backup_progress(backup_progress_t *progress);
+
+void backup_request_started(void);
+
+void backup_request_finished(void);
+
+#endif // !BACKUP_H
@@ -0,0 +1,279 @@
+#define _GNU_SOURCE
+
+#include "channel.h"
+#include "request.h"
+#include "when_macros.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Descriptors passed with a shared memory offer
+enum { SHM_FD_REGION, SHM_FD_SERVER_EVENT, SHM_FD_CLIENT_EVENT, SHM_FD_COUNT };
+
+void channel_init(channel_t *channel, int fd) {
+  *channel = (channel_t){.fd = fd, .wait_fd = -1, .wake_fd = -1};
+}
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+// Sleep until the peer signals the eventfd, or the socket becomes readable
+// which, once the rings are in use, only happens when the peer is gone or
+// the connection was shut down by a timer
+static int shm_sleep(channel_t *channel) {
+  struct pollfd fds[2] = {{.fd = channel->wait_fd, .events = POLLIN},
+                          {.fd = channel->fd, .events = POLLIN}};
+  eventfd_t value;
+  while (-1 == poll(fds, 2, -1))
+    if (errno != EINTR) {
+      perror("poll");
+      return -1;
+    }
+  if (fds[1].revents != 0) {
+    fprintf(stderr, "WARNING: Connection prematurely closed.\n");
+    return -1;
+  }
+  eventfd_read(channel->wait_fd, &value);
+  return 0;
+}
+
+// Wait until `counter` moves away from `value`, spinning first then sleeping
+// with `waiting` set so that the peer knows it must signal the eventfd
+static int shm_wait(channel_t *channel, atomic_uint *counter, unsigned value,
+                    atomic_int *waiting) {
+  for (int spin = 0; spin < channel->spin_count; spin++) {
+    if (atomic_load_explicit(counter, memory_order_acquire) != value)
+      return 0;
+    cpu_relax();
+  }
+  int rc = 0;
+  while (rc == 0 && atomic_load(counter) == value) {
+    atomic_store(waiting, 1);
+    if (atomic_load(counter) == value)
+      rc = shm_sleep(channel);
+    atomic_store(waiting, 0);
+  }
+  return rc;
+}
+
+static inline void shm_wake(channel_t *channel, atomic_int *waiting) {
+  if (atomic_load(waiting))
+    eventfd_write(channel->wake_fd, 1);
+}
+
+static int shm_send(channel_t *channel, const char *buffer, size_t size) {
+  struct shm_ring *ring = channel->tx;
+  unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  while (size > 0) {
+    // The ring is full while the reader is a whole ring behind
+    if (0 != shm_wait(channel, &ring->tail, head - SHM_RING_SIZE,
+                      &ring->writer_waiting))
+      return -1;
+    unsigned room =
+        SHM_RING_SIZE - (head - atomic_load_explicit(&ring->tail,
+                                                     memory_order_acquire));
+    unsigned offset = head % SHM_RING_SIZE;
+    size_t len = size < room ? size : room;
+    if (len > SHM_RING_SIZE - offset)
+      len = SHM_RING_SIZE - offset;
+    memcpy(ring->data + offset, buffer, len);
+    buffer += len;
+    size -= len;
+    head += len;
+    atomic_store(&ring->head, head);
+    shm_wake(channel, &ring->reader_waiting);
+  }
+  return 0;
+}
+
+static int shm_recv(channel_t *channel, char *buffer, size_t size) {
+  struct shm_ring *ring = channel->rx;
+  unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  while (size > 0) {
+    if (0 != shm_wait(channel, &ring->head, tail, &ring->reader_waiting))
+      return -1;
+    unsigned available =
+        atomic_load_explicit(&ring->head, memory_order_acquire) - tail;
+    unsigned offset = tail % SHM_RING_SIZE;
+    size_t len = size < available ? size : available;
+    if (len > SHM_RING_SIZE - offset)
+      len = SHM_RING_SIZE - offset;
+    memcpy(buffer, ring->data + offset, len);
+    buffer += len;
+    size -= len;
+    tail += len;
+    atomic_store(&ring->tail, tail);
+    shm_wake(channel, &ring->writer_waiting);
+  }
+  return 0;
+}
+
+int channel_send(channel_t *channel, const void *buffer, size_t size) {
+  if (channel->shm != NULL)
+    return shm_send(channel, buffer, size);
+  return send_body(channel->fd, buffer, size);
+}
+
+int channel_recv(channel_t *channel, void *buffer, size_t size) {
+  if (channel->shm != NULL)
+    return shm_recv(channel, buffer, size);
+  return receive_body_into(channel->fd, buffer, size);
+}
+
+int channel_has_input(channel_t *channel) {
+  char byte;
+  if (channel->shm != NULL &&
+      atomic_load(&channel->rx->head) != atomic_load(&channel->rx->tail))
+    return 1;
+  ssize_t rc = recv(channel->fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  return rc >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+int channel_is_local(const channel_t *channel) {
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  if (0 != getsockname(channel->fd, (struct sockaddr *)&addr, &len))
+    return 0;
+  return addr.ss_family == AF_UNIX;
+}
+
+static int shm_map(channel_t *channel, int region_fd) {
+  void *shm = mmap(NULL, sizeof(struct shm_region), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, region_fd, 0);
+  if (shm == MAP_FAILED) {
+    perror("mmap");
+    return -1;
+  }
+  channel->shm = shm;
+  // Spinning only delays the peer when both share a single processor
+  channel->spin_count =
+      sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHM_SPIN_COUNT : 0;
+  return 0;
+}
+
+int channel_offer_shm(channel_t *channel) {
+  int fds[SHM_FD_COUNT] = {-1, -1, -1};
+  response_header_t header = {NO_ERROR, 0, 0, 0};
+  char control[CMSG_SPACE(sizeof(fds))] = {0};
+  struct iovec iov = {.iov_base = &header, .iov_len = sizeof(header)};
+  struct msghdr msg = {.msg_iov = &iov,
+                       .msg_iovlen = 1,
+                       .msg_control = control,
+                       .msg_controllen = sizeof(control)};
+
+  // The region is zeroed by ftruncate: both rings start empty
+  fds[SHM_FD_REGION] = memfd_create("streaming-channel", MFD_CLOEXEC);
+  when_true_jmp(fds[SHM_FD_REGION] < 0, error,
+                "ERROR: Failed to create shared memory: %s\n", strerror(errno));
+  when_true_jmp(0 != ftruncate(fds[SHM_FD_REGION], sizeof(struct shm_region)),
+                error, "ERROR: Failed to size shared memory: %s\n",
+                strerror(errno));
+  fds[SHM_FD_SERVER_EVENT] = eventfd(0, EFD_CLOEXEC);
+  fds[SHM_FD_CLIENT_EVENT] = eventfd(0, EFD_CLOEXEC);
+  when_true_jmp(fds[SHM_FD_SERVER_EVENT] < 0 || fds[SHM_FD_CLIENT_EVENT] < 0,
+                error, "ERROR: Failed to create eventfd: %s\n",
+                strerror(errno));
+  if (0 != shm_map(channel, fds[SHM_FD_REGION]))
+    goto error;
+
+  // Acknowledge the request with the descriptors attached
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  if (sizeof(header) != sendmsg(channel->fd, &msg, MSG_NOSIGNAL)) {
+    perror("sendmsg");
+    munmap(channel->shm, sizeof(struct shm_region));
+    channel->shm = NULL;
+    goto error;
+  }
+  close(fds[SHM_FD_REGION]);
+  channel->rx = &channel->shm->to_server;
+  channel->tx = &channel->shm->to_client;
+  channel->wait_fd = fds[SHM_FD_SERVER_EVENT];
+  channel->wake_fd = fds[SHM_FD_CLIENT_EVENT];
+  return 0;
+error:
+  for (int i = 0; i < SHM_FD_COUNT; i++)
+    if (fds[i] >= 0)
+      close(fds[i]);
+  return -1;
+}
+
+// Close the descriptors of every SCM_RIGHTS message of a refused offer
+static void close_received_fds(struct msghdr *msg) {
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+    size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < count; i++) {
+      int fd;
+      memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+      close(fd);
+    }
+  }
+}
+
+int channel_attach_shm(channel_t *channel) {
+  int fds[SHM_FD_COUNT];
+  request_header_t request = {SHM_ATTACH, 0};
+  response_header_t header;
+  char control[CMSG_SPACE(sizeof(fds))];
+  struct iovec iov = {.iov_base = &header, .iov_len = sizeof(header)};
+  struct msghdr msg = {.msg_iov = &iov,
+                       .msg_iovlen = 1,
+                       .msg_control = control,
+                       .msg_controllen = sizeof(control)};
+
+  if (0 != send_header(channel->fd, &request, sizeof(request)))
+    return -1;
+  ssize_t received = recvmsg(channel->fd, &msg, MSG_CMSG_CLOEXEC);
+  if (sizeof(header) != received) {
+    fprintf(stderr, "ERROR: Failed to receive shared memory offer\n");
+    if (received > 0)
+      close_received_fds(&msg);
+    return -1;
+  }
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (header.code != NO_ERROR || cmsg == NULL ||
+      cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+    fprintf(stderr, "ERROR: Shared memory refused by the server\n");
+    close_received_fds(&msg);
+    return -1;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+  int rc = shm_map(channel, fds[SHM_FD_REGION]);
+  close(fds[SHM_FD_REGION]);
+  if (rc != 0) {
+    close(fds[SHM_FD_SERVER_EVENT]);
+    close(fds[SHM_FD_CLIENT_EVENT]);
+    return -1;
+  }
+  channel->rx = &channel->shm->to_client;
+  channel->tx = &channel->shm->to_server;
+  channel->wait_fd = fds[SHM_FD_CLIENT_EVENT];
+  channel->wake_fd = fds[SHM_FD_SERVER_EVENT];
+  return 0;
+}
+
+void channel_close(channel_t *channel) {
+  if (channel->shm != NULL)
+    munmap(channel->shm, sizeof(struct shm_region));
+  if (channel->wait_fd >= 0)
+    close(channel->wait_fd);
+  if (channel->wake_fd >= 0)
+    close(channel->wake_fd);
+  close(channel->fd);
+  channel_init(channel, -1);
+}
@@ -0,0 +1,77 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @file channel.h
+ * @brief Transport of request and response frames
+ * A channel carries frames over a socket, or over a pair of single-producer
+ * single-consumer rings in a shared memory region for clients running on the
+ * same host. A shared memory channel is offered by the server in response to
+ * a SHM_ATTACH request received on an AF_UNIX socket: the region and the
+ * eventfds waking each side are passed along with the response. The socket
+ * stays open to detect the departure of the peer.
+ */
+
+#define SHM_RING_SIZE (1 << 18)
+// Checks of an empty or full ring before sleeping on the eventfd
+#define SHM_SPIN_COUNT 4096
+
+/**
+ * @struct shm_ring
+ * @brief Byte stream from one side of a shared memory channel to the other
+ */
+struct shm_ring {
+  alignas(64) atomic_uint head;  /**< Bytes written since the creation */
+  alignas(64) atomic_uint tail;  /**< Bytes read since the creation */
+  alignas(64) atomic_int reader_waiting; /**< Reader sleeps for data */
+  atomic_int writer_waiting;     /**< Writer sleeps for room */
+  alignas(64) char data[SHM_RING_SIZE];
+};
+
+/**
+ * @struct shm_region
+ * @brief Content of the shared memory of a channel
+ */
+struct shm_region {
+  struct shm_ring to_server; /**< Requests */
+  struct shm_ring to_client; /**< Responses */
+};
+
+typedef struct channel channel_t;
+
+/**
+ * @struct channel
+ * @brief One side of a connection
+ */
+struct channel {
+  int fd;                    /**< Socket of the connection */
+  struct shm_region *shm;    /**< Shared memory, NULL for socket channels */
+  struct shm_ring *rx;       /**< Ring read by this side */
+  struct shm_ring *tx;       /**< Ring written by this side */
+  int wait_fd;               /**< Eventfd this side sleeps on */
+  int wake_fd;               /**< Eventfd the peer sleeps on */
+  int spin_count;            /**< Checks of the ring before sleeping */
+};
+
+void channel_init(channel_t *channel, int fd);
+
+int channel_send(channel_t *channel, const void *buffer, size_t size);
+
+int channel_recv(channel_t *channel, void *buffer, size_t size);
+
+int channel_has_input(channel_t *channel);
+
+int channel_is_local(const channel_t *channel);
+
+int channel_offer_shm(channel_t *channel);
+
+int channel_attach_shm(channel_t *channel);
+
+void channel_close(channel_t *channel);
+
+#endif // !CHANNEL_H
@@ -1,16 +1,19 @@
+#include "channel.h"
+#include "display.h"
 #include "request.h"
 #include "string.h"
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #define MAX_LINE 1024
-#define FIELD_MAX_LEN 1024
 
 const char *COMMAND_HELPER_TXT = "\
 0) CREATE_FILM      \n\
@@ -19,29 +22,71 @@ const char *COMMAND_HELPER_TXT = "\
 3) LIST_TITLES      \n\
 4) LIST_FILMS       \n\
 5) GET_FILM         \n\
-6) LIST_BY_GENRE    \
+6) LIST_BY_GENRE    \n\
+7) WATCH            \n\
+9) BACKUP           \n\
+10) SLOW_LOG        \n\
+11) GET_FILMS       \n\
+12) AGGREGATE       \
 ";
 
-void display_body(size_t body_size, char *body) {
-  char field[FIELD_MAX_LEN];
-  if (body_size == 0)
+const char *DELTA_KIND_TXT[] = {"CREATED", "REMOVED", "GENRE_ADDED"};
+
+// Last response to a read of the catalog, shown again while not modified
+static struct {
+  command_e command;
+  char request[3 * FIELD_MAX_LEN + 5];
+  size_t request_size;
+  response_header_t header;
+  char *body;
+} cache;
+
+static int is_versioned(command_e command) {
+  return command == LIST_TITLES || command == LIST_FILMS ||
+         command == GET_FILM || command == LIST_BY_GENRE;
+}
+
+// Tag the request with the version of the cached response to the same one
+static size_t tag_request(command_e command, char *body, size_t body_size,
+                          size_t capacity) {
+  if (!is_versioned(command) || cache.body == NULL ||
+      cache.command != command || cache.request_size != body_size ||
+      0 != memcmp(cache.request, body, body_size))
+    return body_size;
+  return body_size + snprintf(body + body_size, capacity - body_size,
+                              "\x1F%u", cache.header.version);
+}
+
+// Keep a successful read, taking ownership of its body
+static void cache_response(command_e command, const char *request,
+                           size_t request_size, response_header_t header,
+                           char **body) {
+  if (!is_versioned(command) || header.code != NO_ERROR || *body == NULL)
     return;
-  unsigned start = 0;
-  char newline = 1;
-  // Read until body_size + 1 (send_body puts a '\0' at body_size + 1)
-  for (unsigned i = 0; i < body_size; i++) {
-    if (body[i] == BODY_FIELD_SEPARATOR || body[i] == BODY_RECORD_SEPARATOR) {
-      const char *fmt = (newline ? "| %s |" : " %s |");
-      newline = (body[i] == BODY_RECORD_SEPARATOR);
-      body[i] = '\0';
-      snprintf(field, FIELD_MAX_LEN, fmt, body + start);
-      printf("%s", field);
-      if (newline)
-        printf("\n");
-      start = i + 1;
-    }
-  }
-  printf(" %s |\n", body + start);
+  free(cache.body);
+  cache.command = command;
+  memcpy(cache.request, request, request_size);
+  cache.request_size = request_size;
+  cache.header = header;
+  cache.body = *body;
+  *body = NULL;
+}
+
+// A delta body is: sequence number, kind of change, film record
+void display_delta(size_t body_size, const char *body) {
+  string_t view, seq, kind_field, record;
+  string_tokenizer_t fields;
+  int kind;
+  string_init_view(&view, body, body_size);
+  string_tokenizer_init(&fields, view);
+  string_tokenize(&fields, BODY_FIELD_SEPARATOR, &seq);
+  string_tokenize(&fields, BODY_FIELD_SEPARATOR, &kind_field);
+  if (0 != string_to_integer(kind_field, &kind) || kind < 0 ||
+      (size_t)kind >= sizeof(DELTA_KIND_TXT) / sizeof(*DELTA_KIND_TXT))
+    return;
+  string_init_view(&record, fields.cursor, fields.end - fields.cursor);
+  printf("n°%.*s %s ", (int)seq.len, seq.str, DELTA_KIND_TXT[kind]);
+  display_body(record.len, record.str);
 }
 
 void display_response(response_header_t header, char *body) {
@@ -49,41 +94,64 @@ void display_response(response_header_t header, char *body) {
   switch (header.code) {
   case NO_ERROR:
     fprintf(stderr, "The command ran successfuly on the server\n");
+    if (header.version != 0)
+      fprintf(stderr, "Version %u\n", header.version);
     display_body(header.body_size, body);
     break;
+  case NOT_MODIFIED:
+    fprintf(stderr, "Not modified since version %u\n", header.version);
+    display_body(cache.header.body_size, cache.body);
+    break;
   case INTERNAL_ERROR:
     fprintf(stderr, "An internal server error occured.\n");
     break;
   case ERROR_NOT_FOUND:
     fprintf(stderr, "Film not found.\n");
     break;
+  case WATCH_DELTA:
+    display_delta(header.body_size, body);
+    break;
+  case WATCH_RESYNC:
+    fprintf(stderr, "Changes were missed, list films again (resume after %s)\n",
+            body);
+    break;
   default:
     fprintf(stderr, "Unknown error code: %d\n", header.code);
     break;
   }
 }
 
-int perform_request(int req_fd, request_header_t req_header,
-                    const char *req_body, response_header_t *res_header,
-                    char **res_body) {
-  // Send request header
-  if (0 != send_header(req_fd, &req_header, sizeof(request_header_t)))
+int receive_response(channel_t *channel, response_header_t *res_header,
+                     char **res_body) {
+  *res_body = NULL;
+  if (0 != channel_recv(channel, res_header, sizeof(response_header_t)))
     return -1;
-  // Send request body
-  if (0 != send_body(req_fd, req_body, req_header.body_size))
+  if (res_header->body_size == 0)
+    return 0;
+  if (NULL == (*res_body = calloc(res_header->body_size + 1, 1)))
     return -1;
-  fprintf(stderr, "INFO: Waiting for response...\n");
-  // Receive response header
-  if (0 != receive_header(req_fd, res_header, sizeof(response_header_t)))
-    return -1;
-  if (res_header->body_size == 0) {
+  if (0 != channel_recv(channel, *res_body, res_header->body_size)) {
+    free(*res_body);
     *res_body = NULL;
-    goto end;
+    return -1;
   }
-  // Receive response body
-  if (NULL == (*res_body = receive_body(req_fd, res_header->body_size)))
+  return 0;
+}
+
+int perform_request(channel_t *channel, request_header_t req_header,
+                    const char *req_body, response_header_t *res_header,
+                    char **res_body) {
+  // Send request header and body as a single frame
+  char frame[sizeof(request_header_t) + UINT16_MAX];
+  memcpy(frame, &req_header, sizeof(request_header_t));
+  memcpy(frame + sizeof(request_header_t), req_body, req_header.body_size);
+  if (0 != channel_send(channel, frame,
+                        sizeof(request_header_t) + req_header.body_size))
+    return -1;
+  fprintf(stderr, "INFO: Waiting for response...\n");
+  // Receive response header and body
+  if (0 != receive_response(channel, res_header, res_body))
     return -1;
-end:
   fprintf(stderr, "INFO: Response received.\n");
   return 0;
 }
@@ -105,42 +173,88 @@ static int getfield(char *field) {
   return 0;
 }
 
-int main(int argc, char *argv[]) {
-  int sock_fd;
+// Connect to a local server through its unix socket path
+static int connect_unix(const char *path) {
+  struct sockaddr_un unixaddr;
+  memset(&unixaddr, 0, sizeof(unixaddr));
+  unixaddr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(unixaddr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return -1;
+  }
+  strcpy(unixaddr.sun_path, path);
+  int sock_fd = socket(PF_UNIX, SOCK_STREAM, 0);
+  if (-1 == connect(sock_fd, (struct sockaddr *)&unixaddr, sizeof(unixaddr))) {
+    perror("connect");
+    close(sock_fd);
+    return -1;
+  }
+  return sock_fd;
+}
+
+// Connect to a server through <address>:<port>
+static int connect_tcp(char *address) {
   struct sockaddr_in servaddr;
   char *port_delimiter, *endptr;
   unsigned long port;
 
-  // Parse address and port to connect to from command line
-  port_delimiter = strstr(argv[1], ":");
-  if (argc != 2 || NULL == port_delimiter) {
-    fprintf(stderr, "Usage: ./client <address>:<port>");
-    goto error;
+  port_delimiter = strstr(address, ":");
+  if (NULL == port_delimiter) {
+    fprintf(stderr, "Invalid address: %s\n", address);
+    return -1;
   }
   *port_delimiter = '\0';
   port = strtoul(port_delimiter + 1, &endptr, 10);
   if (port == 0 || port >= (1 << 16)) {
     fprintf(stderr, "Invalid port number: %lu from: \"%s\"\n", port,
             port_delimiter + 1);
-    goto error;
+    return -1;
   }
 
   // Create socket and connect to server
-  sock_fd = socket(PF_INET, SOCK_STREAM, 0);
+  int sock_fd = socket(PF_INET, SOCK_STREAM, 0);
   memset(&servaddr, 0, sizeof(servaddr));
   servaddr.sin_family = AF_INET;
   servaddr.sin_port = htons(port);
-  if (1 != inet_pton(AF_INET, argv[1], &servaddr.sin_addr)) {
-    fprintf(stderr, "Invalid address: %s\n", argv[1]);
-    goto error;
+  if (1 != inet_pton(AF_INET, address, &servaddr.sin_addr)) {
+    fprintf(stderr, "Invalid address: %s\n", address);
+    close(sock_fd);
+    return -1;
   }
   if (-1 == connect(sock_fd, (struct sockaddr *)&servaddr, sizeof(servaddr))) {
     perror("connect");
+    close(sock_fd);
+    return -1;
+  }
+  return sock_fd;
+}
+
+int main(int argc, char *argv[]) {
+  channel_t channel;
+  int sock_fd;
+
+  // Parse the server to connect to from command line
+  if (argc != 2) {
+    fprintf(stderr, "Usage: ./client <address>:<port> | unix:<path> | "
+                    "shm:<path>\n");
     goto error;
   }
+  if (0 == strncmp(argv[1], "unix:", 5))
+    sock_fd = connect_unix(argv[1] + 5);
+  else if (0 == strncmp(argv[1], "shm:", 4))
+    sock_fd = connect_unix(argv[1] + 4);
+  else
+    sock_fd = connect_tcp(argv[1]);
+  if (sock_fd == -1)
+    goto error;
+  channel_init(&channel, sock_fd);
+  // Exchange frames through shared memory with a server on the same host
+  if (0 == strncmp(argv[1], "shm:", 4) && 0 != channel_attach_shm(&channel))
+    goto error;
 
   unsigned rc, command, id, year;
-  size_t body_size = 0;
+  unsigned long since;
+  size_t body_size = 0, request_size;
   char title[FIELD_MAX_LEN];
   char genre[FIELD_MAX_LEN];
   char director[FIELD_MAX_LEN];
@@ -203,14 +317,65 @@ int main(int argc, char *argv[]) {
       getfield(genre);
       body_size = snprintf(body, 3 * FIELD_MAX_LEN + 5, "%s", genre);
       break;
+    case WATCH:
+      printf("Resume after change n° (0 for new changes only): ");
+      if (1 != scanf("%lu", &since)) {
+        fprintf(stderr, "Invalid change number.\n");
+        continue;
+      }
+      body_size = snprintf(body, 3 * FIELD_MAX_LEN + 5, "%lu", since);
+      break;
+    case SLOW_LOG:
+      body_size = 0;
+      break;
+    case GET_FILMS:
+      printf("Film ids to get (space separated): ");
+      getfield(body);
+      // Replace the spaces between ids with field separators
+      body_size = 0;
+      for (char *cursor = body; *cursor != '\0'; cursor++)
+        if (*cursor != ' ' || (body_size > 0 && body[body_size - 1] != '\x1F'))
+          body[body_size++] = *cursor == ' ' ? '\x1F' : *cursor;
+      if (body_size > 0 && body[body_size - 1] == '\x1F')
+        body_size--;
+      break;
+    case AGGREGATE:
+      printf("Count films by (genre, year or director): ");
+      getfield(genre);
+      printf("Largest groups to show (0 for all): ");
+      if (1 != getuint(&id)) {
+        fprintf(stderr, "Invalid number.\n");
+        continue;
+      }
+      body_size = snprintf(body, 3 * FIELD_MAX_LEN + 5, "%s\x1F%u", genre, id);
+      break;
+    case BACKUP:
+      printf("Start a backup (1) or report its progress (0): ");
+      if (1 != getuint(&id)) {
+        fprintf(stderr, "Invalid choice.\n");
+        continue;
+      }
+      body_size = snprintf(body, 3 * FIELD_MAX_LEN + 5, "%s",
+                           id ? "" : BACKUP_STATUS);
+      break;
     default:
       fprintf(stderr, "WARNING: unknown command: %hu\n", command);
       continue;
     }
-    perform_request(sock_fd, (request_header_t){command, body_size}, body,
-                    &res_header, &res_body);
+    request_size = body_size;
+    body_size = tag_request(command, body, body_size, sizeof(body));
+    if (0 != perform_request(&channel, (request_header_t){command, body_size},
+                             body, &res_header, &res_body))
+      goto error;
     display_response(res_header, res_body);
+    cache_response(command, body, request_size, res_header, &res_body);
     free(res_body);
+    // Deltas are pushed by the server until the connection is closed
+    while (command == WATCH &&
+           0 == receive_response(&channel, &res_header, &res_body)) {
+      display_response(res_header, res_body);
+      free(res_body);
+    }
   }
   return EXIT_SUCCESS;
 error:
@@ -1,6 +1,8 @@
 #include "database.h"
+#include "aggregate.h"
 #include "request.h"
 #include "string.h"
+#include "watch.h"
 #include "when_macros.h"
 #include <err.h>
 #include <sqlite3.h>
@@ -13,9 +15,39 @@ CREATE TABLE IF NOT EXISTS films (  \
     title TEXT,                     \
     genre TEXT,                     \
     director TEXT,                  \
-    year INT                        \
+    year INT,                       \
+    version INT NOT NULL DEFAULT 1  \
 );";
 
+// Films created before versioning get the first version
+const char *MIGRATION_REQ =
+    "ALTER TABLE films ADD COLUMN version INT NOT NULL DEFAULT 1";
+
+// The catalog version is bumped by every write, in the same transaction as
+// the write itself. A created or changed film takes the new catalog version,
+// so that a film reusing the rowid of a removed one never has its version.
+// The triggers of the per-film counters they replace are dropped.
+const char *VERSIONING_REQ = "                                       \
+CREATE TABLE IF NOT EXISTS catalog (version INT NOT NULL);         \
+INSERT INTO catalog SELECT 1 WHERE NOT EXISTS (SELECT * FROM catalog); \
+DROP TRIGGER IF EXISTS film_inserted;                              \
+DROP TRIGGER IF EXISTS film_updated;                               \
+CREATE TRIGGER IF NOT EXISTS film_created AFTER INSERT ON films    \
+BEGIN                                                              \
+  UPDATE catalog SET version = version + 1;                        \
+  UPDATE films SET version = (SELECT version FROM catalog)         \
+  WHERE rowid = NEW.rowid;                                         \
+END;                                                               \
+CREATE TRIGGER IF NOT EXISTS film_deleted AFTER DELETE ON films    \
+BEGIN UPDATE catalog SET version = version + 1; END;               \
+CREATE TRIGGER IF NOT EXISTS film_changed                          \
+AFTER UPDATE OF title, genre, director, year ON films              \
+BEGIN                                                              \
+  UPDATE catalog SET version = version + 1;                        \
+  UPDATE films SET version = (SELECT version FROM catalog)         \
+  WHERE rowid = NEW.rowid;                                         \
+END;";
+
 sqlite3 *database_create_connection(const char *filename) {
   sqlite3 *db;
 
@@ -24,13 +56,34 @@ sqlite3 *database_create_connection(const char *filename) {
   int rc = sqlite3_open_v2(filename, &db, flags, NULL);
   when_false_jmp(SQLITE_OK == rc, error, "Cannot open database: %s\n",
                  sqlite3_errmsg(db));
+  // Wait for the other connections instead of failing while they write
+  sqlite3_busy_timeout(db, DATABASE_BUSY_TIMEOUT_MS);
 
-  // Create the database table
-  char *errmsg;
+  // Create the database tables, one connection at a time
+  char *errmsg = NULL;
+  sqlite3_stmt *probe;
+  rc = sqlite3_exec(db, "BEGIN IMMEDIATE", NULL, NULL, &errmsg);
+  when_false_jmp(SQLITE_OK == rc, error, "Failed to begin transaction: %s\n",
+                 errmsg);
   rc = sqlite3_exec(db, CREATION_REQ, NULL, NULL, &errmsg);
-  when_false_jmp(SQLITE_OK == rc, error, "Failed to create table: %s\n",
+  when_false_jmp(SQLITE_OK == rc, rollback, "Failed to create table: %s\n",
                  errmsg);
+  if (SQLITE_OK !=
+      sqlite3_prepare_v2(db, "SELECT version FROM films", -1, &probe, NULL)) {
+    rc = sqlite3_exec(db, MIGRATION_REQ, NULL, NULL, &errmsg);
+    when_false_jmp(SQLITE_OK == rc, rollback, "Failed to migrate table: %s\n",
+                   errmsg);
+  }
+  sqlite3_finalize(probe);
+  rc = sqlite3_exec(db, VERSIONING_REQ, NULL, NULL, &errmsg);
+  when_false_jmp(SQLITE_OK == rc, rollback,
+                 "Failed to create versioning: %s\n", errmsg);
+  rc = sqlite3_exec(db, "COMMIT", NULL, NULL, &errmsg);
+  when_false_jmp(SQLITE_OK == rc, rollback,
+                 "Failed to commit transaction: %s\n", errmsg);
   return db;
+rollback:
+  sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
 error:
   sqlite3_free(errmsg);
   sqlite3_close(db);
@@ -70,12 +123,29 @@ int database_insert_film(sqlite3 *db, film_t film, int *id) {
   if (SQLITE_OK != rc)
     goto fail2bind;
 
+  // The insert commits on its own, number its delta before another write
+  watch_lock_publish();
   rc = sqlite3_step(request);
-  when_false_jmp(SQLITE_DONE == rc, error,
-                 "Failed to evaluate the request: %s\n", sqlite3_errmsg(db));
+  if (SQLITE_DONE != rc) {
+    watch_unlock_publish();
+    fprintf(stderr, "Failed to evaluate the request: %s\n",
+            sqlite3_errmsg(db));
+    goto error;
+  }
+  film.id = sqlite3_last_insert_rowid(db);
   if (id != NULL)
-    *id = sqlite3_last_insert_rowid(db);
+    *id = film.id;
   sqlite3_finalize(request);
+
+  aggregate_change_t change = AGGREGATE_CHANGE_INIT;
+  aggregate_stage_film(&change, &film, 1);
+  aggregate_apply(&change);
+
+  string_t record = EMPTY_STRING;
+  if (0 == watch_encode_film(&film, &record))
+    watch_publish(DELTA_CREATED, record);
+  watch_unlock_publish();
+  string_deinit(&record);
   return DATABASE_ERROR_NO_ERROR;
 fail2bind:
   fprintf(stderr, "Failed bind parameter: %s", sqlite3_errmsg(db));
@@ -86,42 +156,101 @@ error:
 
 int database_delete_film(sqlite3 *db, int rowid) {
   int rc;
-  sqlite3_stmt *request;
-  rc = sqlite3_prepare_v2(db, "DELETE FROM films WHERE rowid = ?", -1, &request,
-                          NULL);
-  when_false_jmp(SQLITE_OK == rc, error, "Failed to prepare the request: %s\n",
+  sqlite3_stmt *select_req = NULL, *delete_req = NULL;
+  string_t record = EMPTY_STRING;
+  aggregate_change_t change = AGGREGATE_CHANGE_INIT;
+  int error = DATABASE_INTERNAL_ERROR, encoded = -1;
+
+  // Number the delta of this write before the one of any later write
+  watch_lock_publish();
+  rc = sqlite3_exec(db, "BEGIN TRANSACTION;", NULL, NULL, NULL);
+  if (SQLITE_OK != rc) {
+    watch_unlock_publish();
+    fprintf(stderr, "Failed to begin transaction: %s\n", sqlite3_errmsg(db));
+    return DATABASE_INTERNAL_ERROR;
+  }
+
+  // Keep the film being removed to publish it to watchers
+  rc = sqlite3_prepare_v2(
+      db, "SELECT title, genre, director, year FROM films WHERE rowid = ?", -1,
+      &select_req, NULL);
+  when_false_jmp(SQLITE_OK == rc, rollback,
+                 "Failed to prepare the request: %s\n", sqlite3_errmsg(db));
+  rc = sqlite3_bind_int(select_req, 1, rowid);
+  when_false_jmp(SQLITE_OK == rc, rollback, "Failed to bind parameter: %s\n",
                  sqlite3_errmsg(db));
-  rc = sqlite3_bind_int(request, 1, rowid);
-  if (SQLITE_OK != rc)
-    goto fail2bind;
+  rc = sqlite3_step(select_req);
+  if (SQLITE_DONE == rc) {
+    error = DATABASE_ERROR_NOT_FOUND;
+    goto rollback;
+  }
+  when_false_jmp(SQLITE_ROW == rc, rollback,
+                 "Failed to evaluate the request: %s\n", sqlite3_errmsg(db));
+  film_t film = {.id = rowid, .year = sqlite3_column_int(select_req, 3)};
+  const char *column;
+  column = (const char *)sqlite3_column_text(select_req, 0);
+  string_init_view(&film.title, column, column ? strlen(column) : 0);
+  column = (const char *)sqlite3_column_text(select_req, 1);
+  string_init_view(&film.genre, column, column ? strlen(column) : 0);
+  column = (const char *)sqlite3_column_text(select_req, 2);
+  string_init_view(&film.director, column, column ? strlen(column) : 0);
+  encoded = watch_encode_film(&film, &record);
+  aggregate_stage_film(&change, &film, -1);
+  sqlite3_finalize(select_req);
+  select_req = NULL;
 
-  rc = sqlite3_step(request);
-  when_false_jmp(SQLITE_DONE == rc, error,
+  rc = sqlite3_prepare_v2(db, "DELETE FROM films WHERE rowid = ?", -1,
+                          &delete_req, NULL);
+  when_false_jmp(SQLITE_OK == rc, rollback,
+                 "Failed to prepare the request: %s\n", sqlite3_errmsg(db));
+  rc = sqlite3_bind_int(delete_req, 1, rowid);
+  when_false_jmp(SQLITE_OK == rc, rollback, "Failed to bind parameter: %s\n",
+                 sqlite3_errmsg(db));
+  rc = sqlite3_step(delete_req);
+  when_false_jmp(SQLITE_DONE == rc, rollback,
                  "Failed to evaluate the request: %s\n", sqlite3_errmsg(db));
-  sqlite3_finalize(request);
-  int count = sqlite3_changes(db);
-  if (count == 0)
-    return DATABASE_ERROR_NOT_FOUND;
+  sqlite3_finalize(delete_req);
+  delete_req = NULL;
+
+  rc = sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+  when_false_jmp(SQLITE_OK == rc, rollback,
+                 "Failed to commit transaction: %s\n", sqlite3_errmsg(db));
+  aggregate_apply(&change);
+  if (0 == encoded)
+    watch_publish(DELTA_REMOVED, record);
+  watch_unlock_publish();
+  string_deinit(&record);
   return DATABASE_ERROR_NO_ERROR;
-fail2bind:
-  fprintf(stderr, "Failed bind parameter: %s", sqlite3_errmsg(db));
-error:
-  sqlite3_finalize(request);
-  return DATABASE_INTERNAL_ERROR;
+rollback:
+  sqlite3_finalize(select_req);
+  sqlite3_finalize(delete_req);
+  string_deinit(&record);
+  aggregate_discard(&change);
+  sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+  watch_unlock_publish();
+  return error;
 }
 
 int database_add_genre(sqlite3 *db, int id, const string_t genre) {
   int rc;
   sqlite3_stmt *select_req, *update_req;
-  int error = DATABASE_INTERNAL_ERROR;
+  string_t record = EMPTY_STRING;
+  aggregate_change_t change = AGGREGATE_CHANGE_INIT;
+  int error = DATABASE_INTERNAL_ERROR, encoded = -1;
 
+  // Number the delta of this write before the one of any later write
+  watch_lock_publish();
   rc = sqlite3_exec(db, "BEGIN TRANSACTION;", NULL, NULL, NULL);
-  when_false_ret(SQLITE_OK == rc, DATABASE_INTERNAL_ERROR,
-                 "Failed to begin transaction: %s\n", sqlite3_errmsg(db));
+  if (SQLITE_OK != rc) {
+    watch_unlock_publish();
+    fprintf(stderr, "Failed to begin transaction: %s\n", sqlite3_errmsg(db));
+    return DATABASE_INTERNAL_ERROR;
+  }
 
-  // Get the genre of the film given by id
-  rc = sqlite3_prepare_v2(db, "SELECT genre FROM films WHERE rowid = ?", -1,
-                          &select_req, NULL);
+  // Get the film given by id
+  rc = sqlite3_prepare_v2(
+      db, "SELECT genre, title, director, year FROM films WHERE rowid = ?", -1,
+      &select_req, NULL);
   when_false_jmp(SQLITE_OK == rc, select_error,
                  "Failed to prepare the request: %s\n", sqlite3_errmsg(db));
   rc = sqlite3_bind_int(select_req, 1, id);
@@ -143,6 +272,19 @@ int database_add_genre(sqlite3 *db, int id, const string_t genre) {
   string_init_view(&new_genre, current_genre, strlen(current_genre));
   string_join(&new_genre, ',', genre);
 
+  // Encode the updated film for watchers while its columns are alive
+  film_t film = {.id = id, .genre = new_genre,
+                 .year = sqlite3_column_int(select_req, 3)};
+  const char *column;
+  column = (const char *)sqlite3_column_text(select_req, 1);
+  string_init_view(&film.title, column, column ? strlen(column) : 0);
+  column = (const char *)sqlite3_column_text(select_req, 2);
+  string_init_view(&film.director, column, column ? strlen(column) : 0);
+  encoded = watch_encode_film(&film, &record);
+  string_t old_genre;
+  string_init_view(&old_genre, current_genre, strlen(current_genre));
+  aggregate_stage_genres(&change, old_genre, new_genre);
+
   // Finalize the request (this will free current_genre)
   sqlite3_finalize(select_req);
 
@@ -167,6 +309,11 @@ int database_add_genre(sqlite3 *db, int id, const string_t genre) {
   rc = sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
   when_false_jmp(SQLITE_OK == rc, rollback,
                  "Failed to commit transaction: %s\n", sqlite3_errmsg(db));
+  aggregate_apply(&change);
+  if (0 == encoded)
+    watch_publish(DELTA_GENRE_ADDED, record);
+  watch_unlock_publish();
+  string_deinit(&record);
   string_deinit(&new_genre);
   return DATABASE_ERROR_NO_ERROR;
 select_error:
@@ -177,60 +324,113 @@ fail2bind:
 update_error:
   sqlite3_finalize(update_req);
 rollback:
+  string_deinit(&record);
   string_deinit(&new_genre);
+  aggregate_discard(&change);
   sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+  watch_unlock_publish();
   return error;
 }
 
-struct columns_args {
-  string_t *result;
-  int *rowcnt;
-};
-
-static int push_columns(void *arg, int n, char **columns,
+int push_columns(void *arg, int n, char **columns,
                         [[maybe_unused]] char **labels) {
   struct columns_args *args = arg;
   char sep;
   string_t right;
+  size_t len = args->result->len;
   for (int i = 0; i < n; i++) {
     sep = (i == 0 ? BODY_RECORD_SEPARATOR : BODY_FIELD_SEPARATOR);
     string_init_view(&right, columns[i], strlen(columns[i]));
-    string_join(args->result, sep, right);
+    if (0 != string_join(args->result, sep, right) ||
+        (args->max_len != 0 && args->result->len > args->max_len)) {
+      // Keep whole rows only
+      args->result->len = len;
+      args->full = 1;
+      return 1;
+    }
   }
   if (NULL != args->rowcnt)
     *args->rowcnt += 1;
   return 0;
 }
 
-int database_list_titles(sqlite3 *db, string_t *body, int *count) {
+// Start a read transaction and get the catalog version, unless the client
+// already has it
+static int begin_versioned_read(sqlite3 *db, uint32_t known_version,
+                                uint32_t *version) {
+  sqlite3_stmt *request;
+  int rc = sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+  when_false_ret(SQLITE_OK == rc, DATABASE_INTERNAL_ERROR,
+                 "Failed to begin transaction: %s\n", sqlite3_errmsg(db));
+  rc = sqlite3_prepare_v2(db, "SELECT version FROM catalog", -1, &request,
+                          NULL);
+  if (SQLITE_OK == rc && SQLITE_ROW == (rc = sqlite3_step(request)))
+    *version = sqlite3_column_int64(request, 0);
+  sqlite3_finalize(request);
+  when_false_jmp(SQLITE_ROW == rc, error,
+                 "ERROR: Failed to read the catalog version (%s)\n",
+                 sqlite3_errmsg(db));
+  if (known_version != *version)
+    return DATABASE_ERROR_NO_ERROR;
+  sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+  return DATABASE_NOT_MODIFIED;
+error:
+  sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+  return DATABASE_INTERNAL_ERROR;
+}
+
+static int end_versioned_read(sqlite3 *db, int rc) {
+  sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+  return rc;
+}
+
+int database_list_titles(sqlite3 *db, uint32_t known_version, string_t *body,
+                         int *count, uint32_t *version) {
   int rc;
-  char *errmsg;
-  struct columns_args args = {.result = body, .rowcnt = count};
+  struct columns_args args = {
+      .result = body, .rowcnt = count, .max_len = RESPONSE_BODY_MAX};
+  *count = 0;
+  rc = begin_versioned_read(db, known_version, version);
+  if (DATABASE_ERROR_NO_ERROR != rc)
+    return rc;
   rc = sqlite3_exec(db, "SELECT rowid, title FROM films", push_columns, &args,
-                    &errmsg);
-  when_false_ret(SQLITE_OK == rc, DATABASE_INTERNAL_ERROR,
+                    NULL);
+  if (SQLITE_ABORT == rc && args.full)
+    rc = SQLITE_OK; // The body is full
+  when_false_ret(SQLITE_OK == rc,
+                 end_versioned_read(db, DATABASE_INTERNAL_ERROR),
                  "ERROR: Failed to list films (%s)\n", sqlite3_errmsg(db));
-  return DATABASE_ERROR_NO_ERROR;
+  return end_versioned_read(db, DATABASE_ERROR_NO_ERROR);
 }
 
-int database_list_films(sqlite3 *db, string_t *body, int *count) {
+int database_list_films(sqlite3 *db, uint32_t known_version, string_t *body,
+                        int *count, uint32_t *version) {
   int rc;
-  char *errmsg;
-  struct columns_args args = {.result = body, .rowcnt = count};
+  struct columns_args args = {
+      .result = body, .rowcnt = count, .max_len = RESPONSE_BODY_MAX};
+  *count = 0;
+  rc = begin_versioned_read(db, known_version, version);
+  if (DATABASE_ERROR_NO_ERROR != rc)
+    return rc;
   rc = sqlite3_exec(db, "SELECT rowid, title, genre, director, year FROM films",
-                    push_columns, &args, &errmsg);
-  when_false_ret(SQLITE_OK == rc, DATABASE_INTERNAL_ERROR,
+                    push_columns, &args, NULL);
+  if (SQLITE_ABORT == rc && args.full)
+    rc = SQLITE_OK; // The body is full
+  when_false_ret(SQLITE_OK == rc,
+                 end_versioned_read(db, DATABASE_INTERNAL_ERROR),
                  "ERROR: Failed to list films (%s)\n", sqlite3_errmsg(db));
-  return DATABASE_ERROR_NO_ERROR;
+  return end_versioned_read(db, DATABASE_ERROR_NO_ERROR);
 }
 
-int database_get_film(sqlite3 *db, unsigned id, string_t *body) {
+int database_get_film(sqlite3 *db, unsigned id, uint32_t known_version,
+                      string_t *body, uint32_t *version) {
   int rc;
   sqlite3_stmt *request;
-  rc = sqlite3_prepare_v2(
-      db,
-      "SELECT rowid, title, genre, director, year FROM films WHERE rowid = ?",
-      -1, &request, NULL);
+  char *columns[6];
+  rc = sqlite3_prepare_v2(db,
+                          "SELECT rowid, title, genre, director, year, version "
+                          "FROM films WHERE rowid = ?",
+                          -1, &request, NULL);
   when_false_ret(SQLITE_OK == rc, DATABASE_INTERNAL_ERROR,
                  "ERROR: Failed to prepare statement (%s)\n",
                  sqlite3_errmsg(db));
@@ -242,11 +442,16 @@ int database_get_film(sqlite3 *db, unsigned id, string_t *body) {
   when_false_jmp(SQLITE_ROW == rc, error,
                  "ERROR: Failed to execute statement (%s)\n",
                  sqlite3_errmsg(db));
-  int column_count = sqlite3_column_count(request);
-  char **columns = malloc(column_count * sizeof(char *));
+  // The version comes last and is not part of the record
+  int column_count = sqlite3_column_count(request) - 1;
+  *version = sqlite3_column_int64(request, column_count);
+  if (*version == known_version) {
+    sqlite3_finalize(request);
+    return DATABASE_NOT_MODIFIED;
+  }
   for (int i = 0; i < column_count; i++)
     columns[i] = (char *)sqlite3_column_text(request, i);
-  struct columns_args args = {body, NULL};
+  struct columns_args args = {body, NULL, 0, RESPONSE_BODY_MAX};
   push_columns(&args, column_count, columns, NULL);
   sqlite3_finalize(request);
   return DATABASE_ERROR_NO_ERROR;
@@ -258,34 +463,89 @@ error:
   return DATABASE_INTERNAL_ERROR;
 }
 
-int database_list_by_genre(sqlite3 *db, string_t genre, string_t *body,
-                           int *count) {
+int database_list_by_genre(sqlite3 *db, string_t genre, uint32_t known_version,
+                           string_t *body, int *count, uint32_t *version) {
   int rc;
   sqlite3_stmt *request;
+  char *columns[5];
   *count = 0;
+  rc = begin_versioned_read(db, known_version, version);
+  if (DATABASE_ERROR_NO_ERROR != rc)
+    return rc;
   rc = sqlite3_prepare_v2(db,
                           "SELECT rowid, title, genre, director, year FROM "
-                          "films WHERE genre LIKE ?",
+                          "films WHERE genre LIKE '%' || ? || '%'",
                           -1, &request, NULL);
-  when_false_ret(SQLITE_OK == rc, DATABASE_INTERNAL_ERROR,
+  when_false_ret(SQLITE_OK == rc,
+                 end_versioned_read(db, DATABASE_INTERNAL_ERROR),
                  "ERROR: Failed to prepare statement (%s)\n",
                  sqlite3_errmsg(db));
-  // Allocate room for matching chars and null terminating byte
-  char *pattern = malloc(genre.len + 3);
-  snprintf(pattern, genre.len + 3, "%%%s%%", genre.str);
-  rc = sqlite3_bind_text(request, 1, pattern, -1, NULL);
+  rc = sqlite3_bind_text(request, 1, genre.str, genre.len, SQLITE_STATIC);
   when_false_jmp(SQLITE_OK == rc, error, "ERROR: Failed to bind id\n");
-  struct columns_args args = {body, count};
+  struct columns_args args = {body, count, 0, RESPONSE_BODY_MAX};
   while (SQLITE_ROW == (rc = sqlite3_step(request))) {
     int column_count = sqlite3_column_count(request);
-    char **columns = malloc(column_count * sizeof(char *));
     for (int i = 0; i < column_count; i++)
       columns[i] = (char *)sqlite3_column_text(request, i);
-    push_columns(&args, column_count, columns, NULL);
+    if (0 != push_columns(&args, column_count, columns, NULL))
+      break; // The body is full
+  }
+  // A row left means the body was full, anything else but the end an error
+  when_false_jmp(SQLITE_DONE == rc || SQLITE_ROW == rc, error,
+                 "ERROR: Failed to list films by genre (%s)\n",
+                 sqlite3_errmsg(db));
+  sqlite3_finalize(request);
+  return end_versioned_read(db, DATABASE_ERROR_NO_ERROR);
+error:
+  sqlite3_finalize(request);
+  return end_versioned_read(db, DATABASE_INTERNAL_ERROR);
+}
+
+int database_get_films(sqlite3 *db, const int *ids, int id_count,
+                       string_t *body, int *count) {
+  int rc, len = 0;
+  sqlite3_stmt *request = NULL;
+  char *columns[6];
+  *count = 0;
+  // Pass the ids as a single JSON array to resolve them in one statement
+  char *array = malloc(id_count * 12 + 3);
+  when_null_ret(array, DATABASE_INTERNAL_ERROR,
+                "ERROR: Failed to allocate ids\n");
+  array[len++] = '[';
+  for (int i = 0; i < id_count; i++)
+    len += sprintf(array + len, i == 0 ? "%d" : ",%d", ids[i]);
+  array[len++] = ']';
+  rc = sqlite3_prepare_v2(db,
+                          "SELECT ids.value, films.rowid, title, genre, "
+                          "director, year FROM json_each(?) AS ids "
+                          "LEFT JOIN films ON films.rowid = ids.value "
+                          "ORDER BY ids.key",
+                          -1, &request, NULL);
+  when_false_jmp(SQLITE_OK == rc, error,
+                 "ERROR: Failed to prepare statement (%s)\n",
+                 sqlite3_errmsg(db));
+  rc = sqlite3_bind_text(request, 1, array, len, free);
+  array = NULL;
+  when_false_jmp(SQLITE_OK == rc, error, "ERROR: Failed to bind ids\n");
+  struct columns_args args = {body, NULL, 0, RESPONSE_BODY_MAX};
+  while (SQLITE_ROW == (rc = sqlite3_step(request))) {
+    // A missing film is a record holding only the requested id
+    int column_count = sqlite3_column_type(request, 1) == SQLITE_NULL ? 1 : 5;
+    int first = column_count == 1 ? 0 : 1;
+    for (int i = 0; i < column_count; i++)
+      columns[i] = (char *)sqlite3_column_text(request, first + i);
+    // Stop at a full body: the client asks again for the remaining ids
+    if (0 != push_columns(&args, column_count, columns, NULL))
+      break;
+    (*count)++;
   }
+  // A row left means the body was full, anything else but the end an error
+  when_false_jmp(SQLITE_DONE == rc || SQLITE_ROW == rc, error,
+                 "ERROR: Failed to get films (%s)\n", sqlite3_errmsg(db));
   sqlite3_finalize(request);
   return DATABASE_ERROR_NO_ERROR;
 error:
+  free(array);
   sqlite3_finalize(request);
   return DATABASE_INTERNAL_ERROR;
 }
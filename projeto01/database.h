@@ -3,20 +3,48 @@
 
 #include "film.h"
 #include <sqlite3.h>
+#include <stdint.h>
 
 #define DATABASE_ERROR_NO_ERROR 0
 #define DATABASE_ERROR_NOT_FOUND 1
 #define DATABASE_INTERNAL_ERROR 2
+#define DATABASE_NOT_MODIFIED 3
+
+#define DATABASE_BUSY_TIMEOUT_MS 5000
+
+struct columns_args {
+  string_t *result;
+  int *rowcnt;
+  int full; // Set when a row did not fit in a response body
+  size_t max_len; // Longest body to encode, 0 for no limit
+};
+
+// sqlite3_exec callback appending a row to the body in args->result, or
+// aborting the statement once the body is full
+int push_columns(void *arg, int n, char **columns, char **labels);
 
 sqlite3 *database_create_connection(const char *filename);
 void database_close_connection(sqlite3 *db);
 int database_insert_film(sqlite3 *db, film_t film, int *id);
 int database_delete_film(sqlite3 *db, int id);
 int database_add_genre(sqlite3 *db, int id, const string_t genre);
-int database_list_titles(sqlite3 *db, string_t *body, int *count);
-int database_list_films(sqlite3 *db, string_t *body, int *count);
-int database_get_film(sqlite3 *db, unsigned id, string_t *body);
-int database_list_by_genre(sqlite3 *db, string_t genre, string_t *body,
-                           int *count);
+// Reads answer DATABASE_NOT_MODIFIED, without body, when the catalog (or
+// film) version is still known_version. Versions start at 1, and a film
+// takes the catalog version of its last change.
+// A body given a fixed buffer is written in place, and lists stop at the
+// last row that fits: count is then the number of rows in the body.
+int database_list_titles(sqlite3 *db, uint32_t known_version, string_t *body,
+                         int *count, uint32_t *version);
+int database_list_films(sqlite3 *db, uint32_t known_version, string_t *body,
+                        int *count, uint32_t *version);
+int database_get_film(sqlite3 *db, unsigned id, uint32_t known_version,
+                      string_t *body, uint32_t *version);
+int database_list_by_genre(sqlite3 *db, string_t genre, uint32_t known_version,
+                           string_t *body, int *count, uint32_t *version);
+// Records of the films given by ids, in the same order, a missing film being
+// a record with its id only. count is the number of leading ids answered,
+// less than id_count when the next record would overflow a response body.
+int database_get_films(sqlite3 *db, const int *ids, int id_count,
+                       string_t *body, int *count);
 
 #endif // !DATABASE_H
@@ -0,0 +1,22 @@
+#include "display.h"
+#include "request.h"
+#include "string.h"
+#include <stdio.h>
+
+void display_body(size_t body_size, const char *body) {
+  string_t view, field;
+  string_tokenizer_t fields;
+  char newline = 1;
+  string_init_view(&view, body, body_size);
+  string_tokenizer_init(&fields, view);
+  while (string_tokenize_any(&fields, BODY_FIELD_SEPARATOR,
+                             BODY_RECORD_SEPARATOR, &field)) {
+    const char *fmt = (newline ? "| %.*s |" : " %.*s |");
+    printf(fmt, (int)(field.len < FIELD_MAX_LEN ? field.len : FIELD_MAX_LEN),
+           field.str);
+    // A record ends at a record separator or at the end of the body
+    newline = (fields.separator != BODY_FIELD_SEPARATOR);
+    if (newline)
+      printf("\n");
+  }
+}
@@ -0,0 +1,10 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <stddef.h>
+
+#define FIELD_MAX_LEN 1024
+
+void display_body(size_t body_size, const char *body);
+
+#endif // !DISPLAY_H
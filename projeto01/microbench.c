@@ -0,0 +1,347 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "database.h"
+#include "display.h"
+#include "request.h"
+#include "string.h"
+#include <malloc.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Microbenchmarks of the body codec: tokenizing and encoding request and
+ * response bodies of 1 to 1M rows.
+ * Allocations are counted by wrapping malloc, calloc, realloc and free at
+ * link time (see the microbench target of the Makefile). Each benchmark is
+ * timed over at least BENCH_MIN_TIME_NS, BENCH_REPEAT times, and the
+ * fastest run is reported. Results can be saved (-s) and compared with a
+ * saved baseline (-b).
+ */
+
+#define BENCH_MIN_TIME_NS 200000000ULL
+#define BENCH_REPEAT 5
+#define BASELINE_MAX_LEN 256
+#define ID_MAX_LEN 12
+
+const size_t ROW_COUNTS[] = {1, 100, 10000, 1000000};
+
+// Realistic film fields, cycled through to build the rows
+const char *TITLES[] = {"The Shawshank Redemption", "Alien", "Spirited Away",
+                        "Once Upon a Time in the West"};
+const char *GENRES[] = {"Drama", "Horror,Science Fiction",
+                        "Animation,Fantasy", "Western"};
+const char *DIRECTORS[] = {"Frank Darabont", "Ridley Scott", "Hayao Miyazaki",
+                           "Sergio Leone"};
+const char *YEARS[] = {"1994", "1979", "2001", "1968"};
+#define TEMPLATES_LEN (sizeof(TITLES) / sizeof(*TITLES))
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static struct {
+  unsigned long allocations;
+  unsigned long long bytes;
+} counters;
+
+void *__wrap_malloc(size_t size) {
+  counters.allocations++;
+  counters.bytes += size;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+  counters.allocations++;
+  counters.bytes += count * size;
+  return __real_calloc(count, size);
+}
+
+// Only count the bytes a realloc adds to the block
+void *__wrap_realloc(void *ptr, size_t size) {
+  size_t previous = ptr ? malloc_usable_size(ptr) : 0;
+  counters.allocations++;
+  counters.bytes += size > previous ? size - previous : 0;
+  return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr) { __real_free(ptr); }
+
+// Inputs shared by the benchmarks, built for the largest row count
+static struct {
+  size_t rows;
+  char (*ids)[ID_MAX_LEN]; // Decimal ids of the rows
+  string_t body;           // Encoded response body of all the rows
+  size_t *row_ends;        // Length of the body holding the first n rows
+  char *frame;             // Fixed buffer of a response body
+  FILE *devnull;
+} fixture;
+
+static void encode_row(size_t row, string_t *body) {
+  char *columns[] = {fixture.ids[row], (char *)TITLES[row % TEMPLATES_LEN],
+                     (char *)GENRES[row % TEMPLATES_LEN],
+                     (char *)DIRECTORS[row % TEMPLATES_LEN],
+                     (char *)YEARS[row % TEMPLATES_LEN]};
+  struct columns_args args = {.result = body, .rowcnt = NULL};
+  push_columns(&args, sizeof(columns) / sizeof(*columns), columns, NULL);
+}
+
+static int fixture_init(size_t rows) {
+  fixture.rows = rows;
+  fixture.ids = malloc(rows * ID_MAX_LEN);
+  fixture.row_ends = malloc((rows + 1) * sizeof(size_t));
+  fixture.frame = malloc(RESPONSE_BODY_MAX);
+  fixture.devnull = fopen("/dev/null", "w");
+  if (!fixture.ids || !fixture.row_ends || !fixture.frame || !fixture.devnull)
+    return -1;
+  fixture.row_ends[0] = 0;
+  for (size_t row = 0; row < rows; row++) {
+    snprintf(fixture.ids[row], ID_MAX_LEN, "%zu", row + 1);
+    encode_row(row, &fixture.body);
+    fixture.row_ends[row + 1] = fixture.body.len;
+  }
+  return 0;
+}
+
+static void bench_string_tokenize(size_t rows) {
+  string_t body, field;
+  string_tokenizer_t fields;
+  size_t count = 0;
+  string_init_view(&body, fixture.body.str, fixture.row_ends[rows]);
+  string_tokenizer_init(&fields, body);
+  while (string_tokenize_any(&fields, BODY_FIELD_SEPARATOR,
+                             BODY_RECORD_SEPARATOR, &field))
+    count++;
+  if (count != 5 * rows)
+    fprintf(stderr, "WARNING: %zu fields split out of %zu\n", count,
+            5 * rows);
+}
+
+static void bench_string_join(size_t rows) {
+  string_t body = EMPTY_STRING, right;
+  for (size_t row = 0; row < rows; row++) {
+    const char *columns[] = {fixture.ids[row], TITLES[row % TEMPLATES_LEN],
+                             GENRES[row % TEMPLATES_LEN],
+                             DIRECTORS[row % TEMPLATES_LEN],
+                             YEARS[row % TEMPLATES_LEN]};
+    for (size_t i = 0; i < sizeof(columns) / sizeof(*columns); i++) {
+      string_init_view(&right, columns[i], strlen(columns[i]));
+      string_join(&body, i == 0 ? BODY_RECORD_SEPARATOR : BODY_FIELD_SEPARATOR,
+                  right);
+    }
+  }
+  string_deinit(&body);
+}
+
+static void bench_push_columns(size_t rows) {
+  string_t body = EMPTY_STRING;
+  for (size_t row = 0; row < rows; row++)
+    encode_row(row, &body);
+  string_deinit(&body);
+}
+
+// Encode the rows in place as the server does, one full body after another
+static void bench_push_columns_frame(size_t rows) {
+  string_t body;
+  string_init_buffer(&body, fixture.frame, RESPONSE_BODY_MAX);
+  for (size_t row = 0; row < rows; row++) {
+    char *columns[] = {fixture.ids[row], (char *)TITLES[row % TEMPLATES_LEN],
+                       (char *)GENRES[row % TEMPLATES_LEN],
+                       (char *)DIRECTORS[row % TEMPLATES_LEN],
+                       (char *)YEARS[row % TEMPLATES_LEN]};
+    struct columns_args args = {.result = &body, .rowcnt = NULL};
+    if (0 != push_columns(&args, sizeof(columns) / sizeof(*columns), columns,
+                          NULL)) {
+      string_init_buffer(&body, fixture.frame, RESPONSE_BODY_MAX);
+      push_columns(&args, sizeof(columns) / sizeof(*columns), columns, NULL);
+    }
+  }
+}
+
+static void bench_string_to_integer(size_t rows) {
+  string_t view;
+  int value;
+  for (size_t row = 0; row < rows; row++) {
+    string_init_view(&view, fixture.ids[row], strlen(fixture.ids[row]));
+    if (0 != string_to_integer(view, &value) || (size_t)value != row + 1)
+      fprintf(stderr, "WARNING: Failed to parse %s\n", fixture.ids[row]);
+  }
+}
+
+static void bench_display_body(size_t rows) {
+  display_body(fixture.row_ends[rows], fixture.body.str);
+}
+
+struct bench {
+  const char *name;
+  void (*run)(size_t rows);
+};
+
+const struct bench BENCHES[] = {
+    {"string_tokenize", bench_string_tokenize},
+    {"string_join", bench_string_join},
+    {"push_columns", bench_push_columns},
+    {"push_columns_frame", bench_push_columns_frame},
+    {"string_to_integer", bench_string_to_integer},
+    {"display_body", bench_display_body},
+};
+
+struct result {
+  char name[64];
+  size_t rows;
+  double ns_per_op, allocs_per_op, bytes_per_op;
+};
+
+static inline unsigned long long now_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static struct result measure(const struct bench *bench, size_t rows) {
+  struct result result = {.rows = rows, .ns_per_op = -1};
+  snprintf(result.name, sizeof(result.name), "%s", bench->name);
+  for (int repeat = 0; repeat < BENCH_REPEAT; repeat++) {
+    unsigned long long iterations = 1, start, elapsed;
+    // Double the iterations until a run lasts long enough to be timed
+    while (1) {
+      counters.allocations = counters.bytes = 0;
+      start = now_ns();
+      for (unsigned long long i = 0; i < iterations; i++)
+        bench->run(rows);
+      elapsed = now_ns() - start;
+      if (elapsed >= BENCH_MIN_TIME_NS / BENCH_REPEAT)
+        break;
+      iterations *= 2;
+    }
+    double ns_per_op = (double)elapsed / iterations;
+    if (result.ns_per_op < 0 || ns_per_op < result.ns_per_op)
+      result.ns_per_op = ns_per_op;
+    result.allocs_per_op = (double)counters.allocations / iterations;
+    result.bytes_per_op = (double)counters.bytes / iterations;
+  }
+  return result;
+}
+
+static size_t load_baseline(const char *path, struct result *baseline,
+                            size_t capacity) {
+  char line[BASELINE_MAX_LEN];
+  size_t count = 0;
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    perror(path);
+    return 0;
+  }
+  while (count < capacity && fgets(line, sizeof(line), file)) {
+    struct result *r = &baseline[count];
+    if (5 == sscanf(line, "%63[^,],%zu,%lf,%lf,%lf", r->name, &r->rows,
+                    &r->ns_per_op, &r->allocs_per_op, &r->bytes_per_op))
+      count++;
+  }
+  fclose(file);
+  return count;
+}
+
+static const struct result *find_result(const struct result *results,
+                                        size_t count, const char *name,
+                                        size_t rows) {
+  for (size_t i = 0; i < count; i++)
+    if (results[i].rows == rows && 0 == strcmp(results[i].name, name))
+      return &results[i];
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  const size_t benches_len = sizeof(BENCHES) / sizeof(*BENCHES);
+  const size_t row_counts_len = sizeof(ROW_COUNTS) / sizeof(*ROW_COUNTS);
+  struct result results[benches_len * row_counts_len];
+  struct result baseline[benches_len * row_counts_len];
+  size_t results_len = 0, baseline_len = 0, max_rows = 1000000;
+  const char *save_path = NULL;
+  const char *filter = NULL;
+  char *endptr;
+  int opt;
+
+  while (-1 != (opt = getopt(argc, argv, "b:f:n:s:"))) {
+    switch (opt) {
+    case 'b':
+      baseline_len =
+          load_baseline(optarg, baseline, benches_len * row_counts_len);
+      break;
+    case 'f':
+      filter = optarg;
+      break;
+    case 'n':
+      max_rows = strtoul(optarg, &endptr, 10);
+      if (*endptr != '\0' || max_rows == 0)
+        goto usage;
+      break;
+    case 's':
+      save_path = optarg;
+      break;
+    default:
+      goto usage;
+    }
+  }
+  size_t fixture_rows = 0;
+  for (size_t i = 0; i < row_counts_len; i++)
+    if (ROW_COUNTS[i] <= max_rows)
+      fixture_rows = ROW_COUNTS[i];
+  if (0 != fixture_init(fixture_rows)) {
+    fprintf(stderr, "ERROR: Failed to build the benchmark inputs\n");
+    return EXIT_FAILURE;
+  }
+  // display_body prints every row: keep the benchmark output readable
+  fflush(stdout);
+  int stdout_fd = dup(STDOUT_FILENO);
+  FILE *out = fdopen(stdout_fd, "w");
+  dup2(fileno(fixture.devnull), STDOUT_FILENO);
+
+  fprintf(out, "%-18s %8s %14s %10s %14s\n", "benchmark", "rows", "ns/op",
+          "allocs/op", "bytes/op");
+  for (size_t b = 0; b < benches_len; b++) {
+    if (filter != NULL && NULL == strstr(BENCHES[b].name, filter))
+      continue;
+    for (size_t r = 0; r < row_counts_len && ROW_COUNTS[r] <= max_rows; r++) {
+      struct result *result = &results[results_len++];
+      *result = measure(&BENCHES[b], ROW_COUNTS[r]);
+      fprintf(out, "%-18s %8zu %14.1f %10.2f %14.1f", result->name,
+              result->rows, result->ns_per_op, result->allocs_per_op,
+              result->bytes_per_op);
+      const struct result *base = find_result(baseline, baseline_len,
+                                              result->name, result->rows);
+      if (base != NULL && base->ns_per_op > 0)
+        fprintf(out, "  %+6.1f%% time, %+.2f allocs",
+                100 * (result->ns_per_op / base->ns_per_op - 1),
+                result->allocs_per_op - base->allocs_per_op);
+      fprintf(out, "\n");
+      fflush(out);
+    }
+  }
+
+  if (save_path != NULL) {
+    FILE *file = fopen(save_path, "w");
+    if (file == NULL) {
+      perror(save_path);
+      return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < results_len; i++)
+      fprintf(file, "%s,%zu,%.1f,%.2f,%.1f\n", results[i].name,
+              results[i].rows, results[i].ns_per_op, results[i].allocs_per_op,
+              results[i].bytes_per_op);
+    fclose(file);
+  }
+  return EXIT_SUCCESS;
+
+usage:
+  fprintf(stderr,
+          "Usage: %s [-n max rows] [-f benchmark name filter] "
+          "[-s save results] [-b baseline to compare with]\n",
+          argv[0]);
+  return EXIT_FAILURE;
+}
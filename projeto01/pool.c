@@ -0,0 +1,120 @@
+#include "pool.h"
+#include "when_macros.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Free buffers kept per thread and in the shared depot, for each size class
+#define POOL_CACHE_MAX 4
+#define POOL_DEPOT_MAX 64
+
+struct pool_block {
+  struct pool_block *next;
+  size_t size_class;
+  max_align_t align[]; // Buffer handed to the caller
+};
+
+struct free_list {
+  struct pool_block *head;
+  unsigned count;
+};
+
+static thread_local struct free_list cache[POOL_CLASSES];
+
+static struct {
+  pthread_mutex_t lock;
+  struct free_list lists[POOL_CLASSES];
+} depot = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static atomic_ulong heap_allocations;
+
+static inline struct pool_block *pop(struct free_list *list) {
+  struct pool_block *block = list->head;
+  if (block != NULL) {
+    list->head = block->next;
+    list->count--;
+  }
+  return block;
+}
+
+static inline void push(struct free_list *list, struct pool_block *block) {
+  block->next = list->head;
+  list->head = block;
+  list->count++;
+}
+
+static inline size_t size_class_of(size_t size) {
+  size_t size_class = 0;
+  while ((size_t)POOL_MIN_SIZE << size_class < size)
+    size_class++;
+  return size_class;
+}
+
+void *pool_alloc(pool_budget_t *budget, size_t size) {
+  when_true_ret(size > POOL_MAX_SIZE, NULL,
+                "ERROR: Buffer of %zu bytes exceeds the pool limit\n", size);
+  size_t size_class = size_class_of(size);
+  size_t capacity = (size_t)POOL_MIN_SIZE << size_class;
+  when_true_ret(budget->in_use + capacity > budget->limit, NULL,
+                "ERROR: Connection memory limit reached (%zu bytes)\n",
+                budget->limit);
+
+  struct pool_block *block = pop(&cache[size_class]);
+  if (block == NULL) {
+    pthread_mutex_lock(&depot.lock);
+    block = pop(&depot.lists[size_class]);
+    pthread_mutex_unlock(&depot.lock);
+  }
+  if (block == NULL) {
+    block = malloc(sizeof(struct pool_block) + capacity);
+    when_null_ret(block, NULL, "ERROR: Failed to allocate a %zu bytes buffer\n",
+                  capacity);
+    block->size_class = size_class;
+    atomic_fetch_add_explicit(&heap_allocations, 1, memory_order_relaxed);
+    budget->heap_allocations++;
+  }
+  budget->in_use += capacity;
+  return block->align;
+}
+
+void pool_free(pool_budget_t *budget, void *buffer) {
+  if (buffer == NULL)
+    return;
+  struct pool_block *block =
+      (void *)((char *)buffer - offsetof(struct pool_block, align));
+  size_t size_class = block->size_class;
+  budget->in_use -= (size_t)POOL_MIN_SIZE << size_class;
+
+  if (cache[size_class].count < POOL_CACHE_MAX) {
+    push(&cache[size_class], block);
+    return;
+  }
+  pthread_mutex_lock(&depot.lock);
+  if (depot.lists[size_class].count < POOL_DEPOT_MAX) {
+    push(&depot.lists[size_class], block);
+    block = NULL;
+  }
+  pthread_mutex_unlock(&depot.lock);
+  free(block);
+}
+
+// Give the cached buffers of an exiting thread back to the depot
+void pool_thread_release(void) {
+  struct pool_block *block;
+  for (size_t size_class = 0; size_class < POOL_CLASSES; size_class++) {
+    pthread_mutex_lock(&depot.lock);
+    while (NULL != (block = pop(&cache[size_class]))) {
+      if (depot.lists[size_class].count < POOL_DEPOT_MAX) {
+        push(&depot.lists[size_class], block);
+      } else {
+        free(block);
+      }
+    }
+    pthread_mutex_unlock(&depot.lock);
+  }
+}
+
+unsigned long pool_heap_allocations(void) {
+  return atomic_load_explicit(&heap_allocations, memory_order_relaxed);
+}
@@ -0,0 +1,42 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/**
+ * @file pool.h
+ * @brief Pooled buffers for request and response frames
+ * Buffers are rounded up to a power of two size class. Freed buffers are
+ * kept in a per-thread cache, then in a shared depot, so that a connection
+ * in steady state reuses the same few buffers without reaching the heap.
+ */
+
+#define POOL_MIN_SIZE 64
+#define POOL_CLASSES 12
+#define POOL_MAX_SIZE (POOL_MIN_SIZE << (POOL_CLASSES - 1))
+
+// Largest request body plus response frame in flight, with room to spare
+#define POOL_CONNECTION_LIMIT (4 * POOL_MAX_SIZE)
+
+/**
+ * @struct pool_budget
+ * @brief Memory accounting of one connection
+ */
+struct pool_budget {
+  size_t in_use;                  /**< Bytes currently held */
+  size_t limit;                   /**< Maximum bytes held at once */
+  unsigned long heap_allocations; /**< Pool misses: buffers malloc'ed */
+};
+
+typedef struct pool_budget pool_budget_t;
+
+void *pool_alloc(pool_budget_t *budget, size_t size);
+
+void pool_free(pool_budget_t *budget, void *buffer);
+
+void pool_thread_release(void);
+
+// Buffers the pool took from the heap, other allocations are not counted
+unsigned long pool_heap_allocations(void);
+
+#endif // !POOL_H
@@ -0,0 +1,324 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "request.h"
+#include "trace.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Replay of a request trace recorded by the server (see trace.h).
+ * Each recorded connection is replayed on its own connection and thread, in
+ * its recorded order. Requests are issued at their recorded time divided by
+ * the speed factor, or back to back with a speed of 0.
+ */
+
+#define FRAME_MAX_LEN (sizeof(request_header_t) + UINT16_MAX + 1)
+// Time allowed to the server to answer a request before it counts as failed
+#define REPLAY_TIMEOUT_S 10
+
+struct request_ref {
+  uint32_t connection; /**< Recorded connection */
+  size_t offset;       /**< Offset of the trace record */
+};
+
+struct replay_connection {
+  const struct request_ref *requests; /**< Requests of the connection */
+  size_t count;                       /**< Number of requests */
+  uint64_t *latencies_ns;             /**< Latency of completed requests */
+  size_t completed;                   /**< Number of completed requests */
+  unsigned long errors;               /**< Requests without a response */
+  pthread_t thread;
+};
+
+static struct {
+  const uint8_t *data;
+  size_t size;
+  double speed;
+  uint64_t first_arrival_ns;
+  struct timespec start;
+  struct sockaddr_in servaddr;
+} replay;
+
+static inline uint64_t elapsed_ns(const struct timespec *since) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since->tv_sec) * 1000000000ULL + now.tv_nsec -
+         since->tv_nsec;
+}
+
+static void wait_until(uint64_t offset_ns) {
+  struct timespec deadline = replay.start;
+  deadline.tv_sec += offset_ns / 1000000000ULL;
+  deadline.tv_nsec += offset_ns % 1000000000ULL;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+  while (0 != clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL))
+    ;
+}
+
+// Header and body are sent in one write, as a small body sent on its own
+// would wait for the acknowledgement of the header (Nagle's algorithm)
+static int replay_request(int fd, const trace_record_t *record,
+                          const char *body, char *buffer) {
+  request_header_t req_header = {record->command, record->body_size};
+  response_header_t res_header;
+  memcpy(buffer, &req_header, sizeof(request_header_t));
+  memcpy(buffer + sizeof(request_header_t), body, record->body_size);
+  if (0 != send_body(fd, buffer, sizeof(request_header_t) + record->body_size))
+    return -1;
+  if (0 != receive_header(fd, &res_header, sizeof(response_header_t)))
+    return -1;
+  return receive_body_into(fd, buffer, res_header.body_size);
+}
+
+static void *replay_connection(void *arg) {
+  struct replay_connection *conn = arg;
+  trace_record_t record;
+  struct timespec sent;
+  struct timeval timeout = {.tv_sec = REPLAY_TIMEOUT_S};
+  char *buffer = malloc(FRAME_MAX_LEN);
+  int fd = socket(PF_INET, SOCK_STREAM, 0);
+  if (buffer == NULL || -1 == fd ||
+      -1 == connect(fd, (struct sockaddr *)&replay.servaddr,
+                    sizeof(replay.servaddr))) {
+    perror("connect");
+    conn->errors = conn->count;
+    goto end;
+  }
+  // A request left unanswered fails instead of stalling the whole replay
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  for (size_t i = 0; i < conn->count; i++) {
+    memcpy(&record, replay.data + conn->requests[i].offset, sizeof(record));
+    // The server pushes changes to watchers: their responses cannot be timed
+    if (record.command == WATCH)
+      continue;
+    if (replay.speed > 0)
+      wait_until((record.arrival_ns - replay.first_arrival_ns) /
+                 replay.speed);
+    clock_gettime(CLOCK_MONOTONIC, &sent);
+    const char *body = (const char *)replay.data + conn->requests[i].offset +
+                       sizeof(trace_record_t);
+    if (0 != replay_request(fd, &record, body, buffer)) {
+      conn->errors += conn->count - i;
+      break;
+    }
+    conn->latencies_ns[conn->completed++] = elapsed_ns(&sent);
+  }
+end:
+  if (fd != -1)
+    close(fd);
+  free(buffer);
+  return NULL;
+}
+
+static int compare_requests(const void *a, const void *b) {
+  const struct request_ref *left = a, *right = b;
+  if (left->connection != right->connection)
+    return left->connection < right->connection ? -1 : 1;
+  return left->offset < right->offset ? -1 : left->offset > right->offset;
+}
+
+static int compare_latencies(const void *a, const void *b) {
+  uint64_t left = *(const uint64_t *)a, right = *(const uint64_t *)b;
+  return left < right ? -1 : left > right;
+}
+
+static int map_trace(const char *path) {
+  struct stat st;
+  trace_header_t header;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return -1;
+  }
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(trace_header_t)) {
+    fprintf(stderr, "ERROR: %s is not a request trace\n", path);
+    close(fd);
+    return -1;
+  }
+  replay.size = st.st_size;
+  replay.data = mmap(NULL, replay.size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (replay.data == MAP_FAILED) {
+    perror("mmap");
+    return -1;
+  }
+  memcpy(&header, replay.data, sizeof(header));
+  if (0 != memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) ||
+      header.version != TRACE_VERSION) {
+    fprintf(stderr, "ERROR: %s is not a version %d request trace\n", path,
+            TRACE_VERSION);
+    munmap((void *)replay.data, replay.size);
+    return -1;
+  }
+  return 0;
+}
+
+// Index the records of the trace, sorted by connection then arrival
+static size_t index_trace(struct request_ref **requests) {
+  trace_record_t record;
+  size_t count = 0, capacity = 0;
+  size_t offset = sizeof(trace_header_t);
+  *requests = NULL;
+  while (offset + sizeof(record) <= replay.size) {
+    memcpy(&record, replay.data + offset, sizeof(record));
+    if (offset + sizeof(record) + record.body_size > replay.size) {
+      fprintf(stderr, "WARNING: Trace truncated at offset %zu\n", offset);
+      break;
+    }
+    // Traces of older servers may hold switches of transport
+    if (trace_is_transport(record.command)) {
+      offset += sizeof(record) + record.body_size;
+      continue;
+    }
+    if (count == capacity) {
+      capacity = capacity ? 2 * capacity : 1024;
+      struct request_ref *grown =
+          realloc(*requests, capacity * sizeof(struct request_ref));
+      if (grown == NULL) {
+        fprintf(stderr, "ERROR: Failed to index the trace\n");
+        break;
+      }
+      *requests = grown;
+    }
+    if (count == 0 || record.arrival_ns < replay.first_arrival_ns)
+      replay.first_arrival_ns = record.arrival_ns;
+    (*requests)[count++] = (struct request_ref){record.connection, offset};
+    offset += sizeof(record) + record.body_size;
+  }
+  qsort(*requests, count, sizeof(struct request_ref), compare_requests);
+  return count;
+}
+
+static void report(struct replay_connection *conns, size_t conn_count,
+                   size_t request_count, uint64_t duration_ns) {
+  size_t completed = 0;
+  unsigned long errors = 0;
+  uint64_t *latencies = malloc(request_count * sizeof(uint64_t) + 1);
+  if (latencies == NULL)
+    return;
+  for (size_t i = 0; i < conn_count; i++) {
+    memcpy(latencies + completed, conns[i].latencies_ns,
+           conns[i].completed * sizeof(uint64_t));
+    completed += conns[i].completed;
+    errors += conns[i].errors;
+  }
+  qsort(latencies, completed, sizeof(uint64_t), compare_latencies);
+  printf("Connections: %zu\n", conn_count);
+  printf("Requests: %zu completed, %lu failed, %zu skipped\n", completed,
+         errors, request_count - completed - errors);
+  printf("Duration (s): %.3f\n", duration_ns / 1e9);
+  printf("Throughput (requests/s): %.1f\n",
+         duration_ns > 0 ? completed * 1e9 / duration_ns : 0.0);
+  if (completed > 0) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < completed; i++)
+      sum += latencies[i];
+    printf("Latency (us): avg %.1f, p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n",
+           sum / 1e3 / completed, latencies[completed / 2] / 1e3,
+           latencies[completed * 90 / 100] / 1e3,
+           latencies[completed * 99 / 100] / 1e3,
+           latencies[completed - 1] / 1e3);
+  }
+  free(latencies);
+}
+
+int main(int argc, char *argv[]) {
+  int opt;
+  char *port_delimiter, *endptr;
+  unsigned long port;
+  struct request_ref *requests = NULL;
+  struct replay_connection *conns = NULL;
+  size_t conn_count = 0;
+  int rc = EXIT_FAILURE;
+
+  replay.speed = 1;
+  while (-1 != (opt = getopt(argc, argv, "s:"))) {
+    switch (opt) {
+    case 's':
+      replay.speed = strtod(optarg, &endptr);
+      if (*endptr != '\0' || replay.speed < 0)
+        goto usage;
+      break;
+    default:
+      goto usage;
+    }
+  }
+  if (argc - optind != 2)
+    goto usage;
+  if (NULL == (port_delimiter = strchr(argv[optind], ':')))
+    goto usage;
+
+  // Parse address and port of the server
+  *port_delimiter = '\0';
+  port = strtoul(port_delimiter + 1, &endptr, 10);
+  if (port == 0 || port >= (1 << 16)) {
+    fprintf(stderr, "Invalid port number: %s\n", port_delimiter + 1);
+    return EXIT_FAILURE;
+  }
+  replay.servaddr.sin_family = AF_INET;
+  replay.servaddr.sin_port = htons(port);
+  if (1 != inet_pton(AF_INET, argv[optind], &replay.servaddr.sin_addr)) {
+    fprintf(stderr, "Invalid address: %s\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+
+  if (0 != map_trace(argv[optind + 1]))
+    return EXIT_FAILURE;
+  // A connection closed by the server fails its requests instead of killing
+  // the replay
+  signal(SIGPIPE, SIG_IGN);
+  size_t request_count = index_trace(&requests);
+
+  // Split the sorted requests by connection
+  conns = calloc(request_count + 1, sizeof(struct replay_connection));
+  uint64_t *latencies = malloc(request_count * sizeof(uint64_t) + 1);
+  if (conns == NULL || latencies == NULL) {
+    fprintf(stderr, "ERROR: Failed to allocate the replay\n");
+    goto end;
+  }
+  for (size_t i = 0; i < request_count; i++) {
+    if (i == 0 || requests[i].connection != requests[i - 1].connection) {
+      conns[conn_count++] = (struct replay_connection){
+          .requests = requests + i, .latencies_ns = latencies + i};
+    }
+    conns[conn_count - 1].count++;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &replay.start);
+  for (size_t i = 0; i < conn_count; i++)
+    pthread_create(&conns[i].thread, NULL, replay_connection, conns + i);
+  for (size_t i = 0; i < conn_count; i++)
+    pthread_join(conns[i].thread, NULL);
+  report(conns, conn_count, request_count, elapsed_ns(&replay.start));
+  rc = EXIT_SUCCESS;
+
+end:
+  free(latencies);
+  free(conns);
+  free(requests);
+  munmap((void *)replay.data, replay.size);
+  return rc;
+
+usage:
+  fprintf(stderr,
+          "Usage: %s [-s speed, 0 for as fast as possible] <address>:<port> "
+          "<trace>\n",
+          argv[0]);
+  return EXIT_FAILURE;
+}
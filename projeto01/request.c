@@ -41,8 +41,8 @@ int send_body(int fd, const char *body, size_t body_size) {
   int rc;
   size_t body_sent = 0;
   while (body_sent < body_size) {
-    rc = write(fd, body, body_size);
-    if (rc < 0 && errno == EAGAIN)
+    rc = write(fd, body + body_sent, body_size - body_sent);
+    if (rc < 0 && (errno == EAGAIN || errno == EINTR))
       continue;
     else if (rc < 0) {
       perror("write body");
@@ -58,26 +58,32 @@ error:
   return -1;
 }
 
-char *receive_body(int fd, size_t body_size) {
+int receive_body_into(int fd, char *body, size_t body_size) {
   size_t body_read = 0;
   int rc;
-  char *body = calloc(body_size + 1, 1);
-  if (body == NULL)
-    return NULL;
   while (body_read < body_size) {
     rc = read(fd, body + body_read, body_size - body_read);
     if (rc < 0 && errno == EINTR)
       continue;
     else if (rc < 0) {
       perror("read");
-      goto error;
+      return -1;
     } else if (rc == 0) {
       fprintf(stderr, "WARNING: Connection prematurely closed.\n");
-      goto error;
+      return -1;
     }
     body_read += rc;
   }
+  return 0;
+}
+
+char *receive_body(int fd, size_t body_size) {
+  char *body = calloc(body_size + 1, 1);
+  if (body == NULL)
+    return NULL;
+  if (0 != receive_body_into(fd, body, body_size)) {
+    free(body);
+    return NULL;
+  }
   return body;
-error:
-  return NULL;
 }
@@ -7,6 +7,9 @@
 #define BODY_RECORD_SEPARATOR '\x1E'
 #define BODY_FIELD_SEPARATOR '\x1F'
 
+// Body of a BACKUP request only asking for the progress of the last backup
+#define BACKUP_STATUS "status"
+
 enum command : uint16_t {
   CREATE_FILM,
   REMOVE_FILM,
@@ -15,6 +18,12 @@ enum command : uint16_t {
   LIST_FILMS,
   GET_FILM,
   LIST_BY_GENRE,
+  WATCH,
+  SHM_ATTACH,
+  BACKUP,
+  SLOW_LOG,
+  GET_FILMS,
+  AGGREGATE,
 };
 
 typedef enum command command_e;
@@ -30,6 +39,9 @@ enum response_code : uint16_t {
   NO_ERROR,
   INTERNAL_ERROR,
   ERROR_NOT_FOUND,
+  WATCH_DELTA,
+  WATCH_RESYNC,
+  NOT_MODIFIED,
 };
 
 typedef enum response_code response_code_e;
@@ -38,16 +50,22 @@ struct response_header {
   response_code_e code;
   uint16_t count;
   uint16_t body_size;
+  uint32_t version; // Catalog or film version of a read, 0 otherwise
 };
 
 typedef struct response_header response_header_t;
 
+// Largest response body sent, so that a response frame fits in 64 KiB
+#define RESPONSE_BODY_MAX (65536 - sizeof(response_header_t))
+
 int send_header(int fd, void *header, size_t header_size);
 
 int receive_header(int fd, void *header, size_t header_size);
 
 int send_body(int fd, const char *body, size_t body_size);
 
+int receive_body_into(int fd, char *body, size_t body_size);
+
 char *receive_body(int fd, size_t body_size);
 
 #endif // !REQUEST_H
@@ -0,0 +1,194 @@
+#include "scheduler.h"
+#include "aggregate.h"
+#include <stdio.h>
+#include <unistd.h>
+
+// Cost of a basic request of each class, which is also the credit given to
+// a waiting connection of the class each time its turn comes
+static const unsigned CLASS_COST[SCHED_CLASSES] = {1, 4, 16};
+// Credit given to each class per round
+static const unsigned CLASS_QUANTUM[SCHED_CLASSES] = {16, 8, 16};
+// Bytes of a GET_FILMS body adding a point lookup to its cost
+#define SCHED_BYTES_PER_LOOKUP 64
+// Groups ranked by an AGGREGATE adding a point lookup to its cost
+#define SCHED_GROUPS_PER_LOOKUP 128
+
+struct sched_queue {
+  sched_client_t *head;
+  sched_client_t *tail;
+  int deficit;      // Credit of the class, negative after a costly request
+  unsigned running; // Slots held by the class
+  unsigned limit;   // Slots the class may hold
+};
+
+static struct {
+  pthread_mutex_t lock;
+  unsigned slots;   // Requests allowed to run concurrently
+  unsigned running; // Slots in use
+  unsigned waiting; // Clients waiting for a slot
+  sched_class_e turn; // Class being served in the round
+  struct sched_queue queues[SCHED_CLASSES];
+} scheduler = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+void scheduler_init(void) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus < 1)
+    cpus = 1;
+  // Keep the processors busy while some requests wait on the database
+  scheduler.slots = 2 * cpus;
+  scheduler.queues[SCHED_POINT].limit = scheduler.slots;
+  scheduler.queues[SCHED_WRITE].limit = 1;
+  scheduler.queues[SCHED_SCAN].limit = cpus > 1 ? cpus / 2 : 1;
+  fprintf(stderr, "INFO: Scheduling %u concurrent requests, %u scans\n",
+          scheduler.slots, scheduler.queues[SCHED_SCAN].limit);
+}
+
+void scheduler_client_init(sched_client_t *client) {
+  *client = (sched_client_t){.class = SCHED_NONE};
+  pthread_cond_init(&client->wakeup, NULL);
+}
+
+void scheduler_client_deinit(sched_client_t *client) {
+  pthread_cond_destroy(&client->wakeup);
+}
+
+sched_class_e scheduler_classify(command_e command, string_t body,
+                                 unsigned *cost) {
+  sched_class_e class;
+  aggregate_dimension_e dimension;
+  string_tokenizer_t fields;
+  string_t name;
+  switch (command) {
+  case GET_FILM:
+    class = SCHED_POINT;
+    break;
+  case GET_FILMS:
+    *cost = CLASS_COST[SCHED_POINT] + body.len / SCHED_BYTES_PER_LOOKUP;
+    return SCHED_POINT;
+  case AGGREGATE:
+    // Ranking the groups of the dimension costs more than a lookup
+    *cost = CLASS_COST[SCHED_POINT];
+    string_tokenizer_init(&fields, body);
+    string_tokenize(&fields, BODY_FIELD_SEPARATOR, &name);
+    if (0 == aggregate_parse_dimension(name, &dimension))
+      *cost += aggregate_groups(dimension) / SCHED_GROUPS_PER_LOOKUP;
+    return SCHED_POINT;
+  case CREATE_FILM:
+  case REMOVE_FILM:
+  case ADD_GENRE:
+    class = SCHED_WRITE;
+    break;
+  case LIST_TITLES:
+  case LIST_FILMS:
+  case LIST_BY_GENRE:
+    class = SCHED_SCAN;
+    break;
+  default:
+    *cost = 0;
+    return SCHED_NONE;
+  }
+  *cost = CLASS_COST[class];
+  return class;
+}
+
+static int eligible(sched_class_e class) {
+  struct sched_queue *queue = &scheduler.queues[class];
+  return queue->head != NULL && queue->running < queue->limit;
+}
+
+// Deficit round-robin over the classes, then over the clients of the class
+static sched_client_t *pick(void) {
+  sched_class_e class;
+  struct sched_queue *queue;
+  sched_client_t *client;
+
+  for (class = 0; class < SCHED_CLASSES && !eligible(class); class++)
+    ;
+  if (class == SCHED_CLASSES)
+    return NULL;
+  while (1) {
+    class = scheduler.turn;
+    queue = &scheduler.queues[class];
+    if (!eligible(class) || queue->deficit < (int)CLASS_COST[class]) {
+      if (queue->head == NULL)
+        queue->deficit = 0;
+      else if (eligible(class))
+        queue->deficit += (int)CLASS_QUANTUM[class];
+      scheduler.turn = (class + 1) % SCHED_CLASSES;
+      continue;
+    }
+    client = queue->head;
+    if (client->deficit < client->cost) {
+      // Not enough credit yet: earn some and let the next client go
+      client->deficit += CLASS_COST[class];
+      if (client->next != NULL) {
+        queue->head = client->next;
+        queue->tail->next = client;
+        queue->tail = client;
+        client->next = NULL;
+      }
+      continue;
+    }
+    queue->head = client->next;
+    if (queue->head == NULL)
+      queue->tail = NULL;
+    queue->deficit -= (int)client->cost;
+    client->deficit = 0;
+    client->next = NULL;
+    return client;
+  }
+}
+
+static void grant(sched_client_t *client) {
+  client->granted = 1;
+  scheduler.running++;
+  scheduler.queues[client->class].running++;
+}
+
+static void dispatch(void) {
+  sched_client_t *client;
+  while (scheduler.waiting > 0 && scheduler.running < scheduler.slots &&
+         NULL != (client = pick())) {
+    scheduler.waiting--;
+    grant(client);
+    pthread_cond_signal(&client->wakeup);
+  }
+}
+
+void scheduler_acquire(sched_client_t *client, sched_class_e class,
+                       unsigned cost) {
+  if (class == SCHED_NONE)
+    return;
+  struct sched_queue *queue = &scheduler.queues[class];
+  pthread_mutex_lock(&scheduler.lock);
+  client->class = class;
+  client->cost = cost;
+  client->granted = 0;
+  if (scheduler.waiting == 0 && scheduler.running < scheduler.slots &&
+      queue->running < queue->limit) {
+    grant(client);
+    pthread_mutex_unlock(&scheduler.lock);
+    return;
+  }
+  if (queue->tail != NULL)
+    queue->tail->next = client;
+  else
+    queue->head = client;
+  queue->tail = client;
+  scheduler.waiting++;
+  dispatch();
+  while (!client->granted)
+    pthread_cond_wait(&client->wakeup, &scheduler.lock);
+  pthread_mutex_unlock(&scheduler.lock);
+}
+
+void scheduler_release(sched_client_t *client) {
+  if (client->class == SCHED_NONE)
+    return;
+  pthread_mutex_lock(&scheduler.lock);
+  scheduler.running--;
+  scheduler.queues[client->class].running--;
+  client->class = SCHED_NONE;
+  dispatch();
+  pthread_mutex_unlock(&scheduler.lock);
+}
@@ -0,0 +1,61 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "request.h"
+#include "string.h"
+#include <pthread.h>
+
+/**
+ * @file scheduler.h
+ * @brief Fair admission of requests to the database
+ * A connection thread acquires a slot before executing a request. Requests
+ * are classified by cost class, and each class may hold only a share of
+ * the slots: a single write runs at a time (SQLite serializes them anyway)
+ * and full scans may only use half of the processors. When requests wait,
+ * slots are given by deficit round-robin across the classes, then across
+ * the connections of the class, weighted by the estimated request cost.
+ * Cheap lookups therefore keep their latency while scans share the rest.
+ * A slot covers the database work of a request only, and is released
+ * before the response is sent. Releasing a slot twice is harmless.
+ */
+
+enum sched_class {
+  SCHED_POINT, // Lookups by id
+  SCHED_WRITE, // Catalog changes
+  SCHED_SCAN,  // Full table scans
+  SCHED_CLASSES,
+  SCHED_NONE = SCHED_CLASSES, // Not scheduled (admin, watch, transport)
+};
+
+typedef enum sched_class sched_class_e;
+
+typedef struct sched_client sched_client_t;
+
+/**
+ * @struct sched_client
+ * @brief Scheduling state of a connection, waiting for at most one slot
+ */
+struct sched_client {
+  sched_client_t *next;  /**< Next client waiting in the class */
+  pthread_cond_t wakeup; /**< Signalled when the slot is granted */
+  int granted;           /**< Was a slot granted */
+  sched_class_e class;   /**< Class of the pending request */
+  unsigned cost;         /**< Estimated cost of the pending request */
+  unsigned deficit;      /**< Credit earned while waiting in the class */
+};
+
+void scheduler_init(void);
+
+void scheduler_client_init(sched_client_t *client);
+
+void scheduler_client_deinit(sched_client_t *client);
+
+sched_class_e scheduler_classify(command_e command, string_t body,
+                                 unsigned *cost);
+
+void scheduler_acquire(sched_client_t *client, sched_class_e class,
+                       unsigned cost);
+
+void scheduler_release(sched_client_t *client);
+
+#endif // !SCHEDULER_H
@@ -1,7 +1,13 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <asm-generic/socket.h>
 #include <assert.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -9,11 +15,21 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include "aggregate.h"
+#include "backup.h"
+#include "channel.h"
 #include "database.h"
+#include "pool.h"
 #include "request.h"
+#include "scheduler.h"
+#include "slowlog.h"
 #include "string.h"
+#include "timer_wheel.h"
+#include "trace.h"
+#include "watch.h"
 #include "when_macros.h"
 
 #define MAX_LINE 1024
@@ -22,79 +38,302 @@ const unsigned short SERV_PORT = 7080;
 const unsigned int MAX_QUEUED_REQUESTS = 1000;
 const unsigned int MAX_PARALLEL_CONNECTIONS = 10;
 
-const unsigned int COMMANDS_LEN = 7;
+const unsigned int COMMANDS_LEN = 13;
+
+// Probe silent peers after KEEPALIVE_IDLE_S and drop them after
+// KEEPALIVE_COUNT unanswered probes sent every KEEPALIVE_INTERVAL_S
+const int KEEPALIVE_IDLE_S = 60;
+const int KEEPALIVE_INTERVAL_S = 10;
+const int KEEPALIVE_COUNT = 3;
+
+// Time allowed to a client between two requests, to send a request body,
+// and to take a response
+unsigned int idle_timeout_s = 300;
+unsigned int read_timeout_s = 10;
+unsigned int write_timeout_s = 10;
+
+// Destination of the backups, and delay between periodic ones (0 if none)
+const char *backup_path = "streaming.db.bak";
+unsigned int backup_interval_s = 0;
+
+// Socket of the listener for clients on the same host
+const char *unix_path = "streaming.sock";
+
+// Identifier of the next connection, as recorded in request traces
+atomic_uint next_connection_id = 1;
+
+typedef struct connection connection_t;
+
+/**
+ * @struct connection
+ * @brief State of a client connection, owned by its thread
+ */
+struct connection {
+  uint32_t id;           /**< Identifier of the connection */
+  channel_t channel;     /**< Socket or shared memory of the client */
+  sqlite3 *db;           /**< Database connection of the thread */
+  pool_budget_t budget;  /**< Pooled buffers held by the connection */
+  wheel_timer_t timer;   /**< Idle, read or write timeout of the connection */
+  atomic_bool timed_out; /**< Was the connection closed by its timer */
+  slow_request_t slow;   /**< Measures of the current request */
+  sched_client_t sched;  /**< Admission of the requests to the database */
+  char *frame;           /**< Pooled response frame of the current request */
+};
+
+// Response frame: the header, then a body encoded in place after it
+#define RESPONSE_FRAME_SIZE (sizeof(response_header_t) + RESPONSE_BODY_MAX)
 
-void send_response(int res_fd, response_header_t header, const char *body) {
+// Called by the timer wheel: unblock the connection thread, which releases
+// the connection resources itself
+static void expire_connection(wheel_timer_t *timer) {
+  connection_t *conn =
+      (connection_t *)((char *)timer - offsetof(connection_t, timer));
+  atomic_store(&conn->timed_out, true);
+  shutdown(conn->channel.fd, SHUT_RDWR);
+}
+
+void send_response(connection_t *conn, response_header_t header,
+                   const char *body) {
+  uint64_t encode_ns = slowlog_clock(), send_ns;
   fprintf(stderr, "INFO: Sending response...\n");
-  send_header(res_fd, &header, sizeof(response_header_t));
-  if (body == NULL || header.body_size == 0)
+  // A client that stops reading is dropped instead of blocking the thread
+  timer_wheel_arm(&conn->timer, write_timeout_s * 1000);
+  if (body == NULL)
+    header.body_size = 0;
+  conn->slow.response_size = header.body_size;
+  // Send header and body as a single frame from a pooled buffer, the body
+  // being usually encoded in the frame already
+  size_t frame_size = sizeof(response_header_t) + header.body_size;
+  char *frame = conn->frame;
+  if (frame != NULL && body == frame + sizeof(response_header_t)) {
+    memcpy(frame, &header, sizeof(response_header_t));
+    send_ns = slowlog_clock();
+    channel_send(&conn->channel, frame, frame_size);
+    goto end;
+  }
+  frame = pool_alloc(&conn->budget, frame_size);
+  if (frame == NULL) {
+    send_ns = slowlog_clock();
+    channel_send(&conn->channel, &header, sizeof(response_header_t));
+    if (header.body_size > 0)
+      channel_send(&conn->channel, body, header.body_size);
     goto end;
-  send_body(res_fd, body, header.body_size);
+  }
+  memcpy(frame, &header, sizeof(response_header_t));
+  if (header.body_size > 0)
+    memcpy(frame + sizeof(response_header_t), body, header.body_size);
+  send_ns = slowlog_clock();
+  channel_send(&conn->channel, frame, frame_size);
+  pool_free(&conn->budget, frame);
 end:
+  timer_wheel_cancel(&conn->timer);
+  conn->slow.phase_ns[SLOW_ENCODE] = send_ns - encode_ns;
+  conn->slow.phase_ns[SLOW_SEND] = slowlog_clock() - send_ns;
   fprintf(stderr, "INFO: Response sent.\n");
 }
 
-int execute_command(command_e command, string_t req_body, sqlite3 *db,
-                    int res_fd) {
+// Body of a BACKUP response: state, pages copied, pages total, destination
+static int encode_backup_progress(string_t *body) {
+  backup_progress_t progress;
+  backup_progress(&progress);
+  const char *state = progress.running  ? "running"
+                      : progress.failed ? "failed"
+                                        : "done";
+  int len = snprintf(NULL, 0, "%s\x1F%d\x1F%d\x1F%s", state, progress.copied,
+                     progress.total, progress.path);
+  char *buffer = string_reserve(body, len);
+  when_null_ret(buffer, DATABASE_INTERNAL_ERROR,
+                "ERROR: Failed to allocate backup progress\n");
+  snprintf(buffer, len + 1, "%s\x1F%d\x1F%d\x1F%s", state, progress.copied,
+           progress.total, progress.path);
+  return DATABASE_ERROR_NO_ERROR;
+}
+
+// Reads of the catalog may end with a field holding the version known by
+// the client, which is taken out of the body. Returns 0 without a tag.
+static uint32_t take_version_tag(string_t *body) {
+  string_t tag;
+  int version;
+  for (size_t i = body->len; i > 0; i--) {
+    if (body->str[i - 1] != BODY_FIELD_SEPARATOR)
+      continue;
+    string_init_view(&tag, body->str + i, body->len - i);
+    if (0 != string_to_integer(tag, &version) || version < 0)
+      return 0;
+    body->len = i - 1;
+    return version;
+  }
+  return 0;
+}
+
+int execute_command(command_e command, string_t req_body, connection_t *conn) {
+  sqlite3 *db = conn->db;
   int rc;
   fprintf(stderr, "COMMAND n°%d\n", command);
 
   film_t film;
-  int id, count;
+  int id, count = 0, *ids;
+  aggregate_dimension_e dimension;
+  uint64_t since;
+  uint32_t known_version, version = 0;
   string_t pid, pyear;              // String view on req_body
-  string_t res_body = EMPTY_STRING; // Allocated string
-  response_header_t res_header = {NO_ERROR, 0, 0};
+  string_t res_body = EMPTY_STRING; // Encoded in the frame when it fits
+  response_header_t res_header = {NO_ERROR, 0, 0, 0};
+  if (conn->frame != NULL)
+    string_init_buffer(&res_body, conn->frame + sizeof(response_header_t),
+                       RESPONSE_BODY_MAX);
+  string_tokenizer_t fields;
+  string_tokenizer_init(&fields, req_body);
+  uint64_t database_ns = slowlog_clock();
   switch (command) {
   case CREATE_FILM:
-    film.title = string_split(BODY_FIELD_SEPARATOR, &req_body);
-    film.genre = string_split(BODY_FIELD_SEPARATOR, NULL);
-    film.director = string_split(BODY_FIELD_SEPARATOR, NULL);
-    pyear = string_split(BODY_FIELD_SEPARATOR, NULL);
-    if (0 != string_to_integer(pyear, &film.year))
+    string_tokenize(&fields, BODY_FIELD_SEPARATOR, &film.title);
+    string_tokenize(&fields, BODY_FIELD_SEPARATOR, &film.genre);
+    string_tokenize(&fields, BODY_FIELD_SEPARATOR, &film.director);
+    string_tokenize(&fields, BODY_FIELD_SEPARATOR, &pyear);
+    if (0 != string_to_integer(pyear, &film.year)) {
+      pid = pyear;
       goto invalid_id;
+    }
     rc = database_insert_film(db, film, &id);
     res_header.count = id;
     break;
   case REMOVE_FILM:
-    pid = string_split(BODY_FIELD_SEPARATOR, &req_body);
+    string_tokenize(&fields, BODY_FIELD_SEPARATOR, &pid);
     if (0 != string_to_integer(pid, &id))
       goto invalid_id;
     rc = database_delete_film(db, id);
     break;
   case ADD_GENRE:
-    pid = string_split(BODY_FIELD_SEPARATOR, &req_body);
+    string_tokenize(&fields, BODY_FIELD_SEPARATOR, &pid);
     if (0 != string_to_integer(pid, &id))
       goto invalid_id;
-    film.genre = string_split(BODY_FIELD_SEPARATOR, NULL);
+    string_tokenize(&fields, BODY_FIELD_SEPARATOR, &film.genre);
     rc = database_add_genre(db, id, film.genre);
     break;
   case LIST_TITLES:
-    rc = database_list_titles(db, &res_body, &count);
+    known_version = take_version_tag(&req_body);
+    rc = database_list_titles(db, known_version, &res_body, &count, &version);
     res_header.count = count;
     break;
   case LIST_FILMS:
-    rc = database_list_films(db, &res_body, &count);
+    known_version = take_version_tag(&req_body);
+    rc = database_list_films(db, known_version, &res_body, &count, &version);
     res_header.count = count;
     break;
   case GET_FILM:
-    if (0 != string_to_integer(req_body, &id))
+    known_version = take_version_tag(&req_body);
+    if (0 != string_to_integer(pid = req_body, &id))
       goto invalid_id;
-    rc = database_get_film(db, id, &res_body);
+    rc = database_get_film(db, id, known_version, &res_body, &version);
     res_header.count = 1;
     break;
   case LIST_BY_GENRE:
-    database_list_by_genre(db, req_body, &res_body, &count);
+    known_version = take_version_tag(&req_body);
+    rc = database_list_by_genre(db, req_body, known_version, &res_body, &count,
+                                &version);
+    res_header.count = count;
+    break;
+  case GET_FILMS:
+    // Ids separated by BODY_FIELD_SEPARATOR, each taking at least 2 bytes
+    ids = pool_alloc(&conn->budget, (req_body.len / 2 + 1) * sizeof(int));
+    if (ids == NULL) {
+      rc = DATABASE_INTERNAL_ERROR;
+      break;
+    }
+    // An invalid id is answered with an error rather than left hanging
+    rc = DATABASE_ERROR_NO_ERROR;
+    for (id = 0; string_tokenize(&fields, BODY_FIELD_SEPARATOR, &pid); id++)
+      if (0 != string_to_integer(pid, &ids[id])) {
+        fprintf(stderr, "WARNING: expected an integer: %.*s\n", (int)pid.len,
+                pid.str);
+        rc = DATABASE_INTERNAL_ERROR;
+        break;
+      }
+    if (DATABASE_ERROR_NO_ERROR == rc)
+      rc = database_get_films(db, ids, id, &res_body, &count);
+    res_header.count = count;
+    pool_free(&conn->budget, ids);
+    break;
+  case WATCH:
+    // Optional body: sequence number of the last delta seen by the client
+    since = req_body.len > 0 ? strtoull(req_body.str, NULL, 10) : 0;
+    // The connection is dedicated to pushing deltas until the client speaks
+    return watch_subscribe(&conn->channel, since, &conn->timer,
+                           write_timeout_s * 1000);
+  case SHM_ATTACH:
+    // Further frames go through shared memory, offered on local sockets only
+    if (conn->channel.shm == NULL && channel_is_local(&conn->channel) &&
+        0 == channel_offer_shm(&conn->channel)) {
+      fprintf(stderr, "INFO: Connection switched to shared memory\n");
+      return 0;
+    }
+    res_header.code = INTERNAL_ERROR;
+    send_response(conn, res_header, NULL);
+    return 0;
+  case BACKUP:
+    // Start a backup unless one is running or the body only asks for the
+    // status, and report the progress of the last one
+    if (!(req_body.len == strlen(BACKUP_STATUS) &&
+          0 == memcmp(req_body.str, BACKUP_STATUS, req_body.len)) &&
+        0 != backup_start("streaming.db", backup_path)) {
+      rc = DATABASE_INTERNAL_ERROR;
+      break;
+    }
+    rc = encode_backup_progress(&res_body);
+    res_header.count = 1;
+    break;
+  case SLOW_LOG:
+    rc = 0 == slowlog_encode(&res_body, &count) ? DATABASE_ERROR_NO_ERROR
+                                                : DATABASE_INTERNAL_ERROR;
+    res_header.count = count;
+    break;
+  case AGGREGATE:
+    // Dimension name, then the optional number of largest groups to send
+    // An invalid request is answered with an error rather than left hanging
+    string_tokenize(&fields, BODY_FIELD_SEPARATOR, &pyear);
+    if (0 != aggregate_parse_dimension(pyear, &dimension)) {
+      fprintf(stderr, "WARNING: unknown dimension: %.*s\n", (int)pyear.len,
+              pyear.str);
+      rc = DATABASE_INTERNAL_ERROR;
+      break;
+    }
+    id = 0;
+    if (string_tokenize(&fields, BODY_FIELD_SEPARATOR, &pid) &&
+        (0 != string_to_integer(pid, &id) || id < 0)) {
+      fprintf(stderr, "WARNING: expected an integer: %.*s\n", (int)pid.len,
+              pid.str);
+      rc = DATABASE_INTERNAL_ERROR;
+      break;
+    }
+    rc = 0 == aggregate_encode(dimension, id, &res_body, &count)
+             ? DATABASE_ERROR_NO_ERROR
+             : DATABASE_INTERNAL_ERROR;
     res_header.count = count;
     break;
   default:
     fprintf(stderr, "WARNING: unknown command: %hu\n", command);
     return -1;
   }
+  conn->slow.phase_ns[SLOW_DATABASE] = slowlog_clock() - database_ns;
   // Set header depending on the return code of database function
+  res_header.version = version;
   switch (rc) {
   case DATABASE_ERROR_NO_ERROR:
+    // A body the header cannot describe is never sent truncated
+    if (res_body.len > RESPONSE_BODY_MAX) {
+      fprintf(stderr, "ERROR: Response body of %zu bytes is too large\n",
+              res_body.len);
+      res_header.code = INTERNAL_ERROR;
+      res_header.count = 0;
+      break;
+    }
     res_header.body_size = res_body.len;
     break;
+  case DATABASE_NOT_MODIFIED:
+    res_header.code = NOT_MODIFIED;
+    res_header.count = 0;
+    break;
   case DATABASE_ERROR_NOT_FOUND:
     res_header.code = ERROR_NOT_FOUND;
     break;
@@ -102,55 +341,200 @@ int execute_command(command_e command, string_t req_body, sqlite3 *db,
     res_header.code = INTERNAL_ERROR;
     break;
   }
+  // The database work is done: a client slow to read its response must not
+  // hold the slot of its class while the response is sent
+  scheduler_release(&conn->sched);
   // Send response header and body
-  send_response(res_fd, res_header, res_body.str);
+  send_response(conn, res_header, res_body.str);
   string_deinit(&res_body);
   return 0;
 invalid_id:
-  fprintf(stderr, "WARNING: id should be an integer: %s\n", pid.str);
+  fprintf(stderr, "WARNING: expected an integer: %.*s\n", (int)pid.len,
+          pid.str);
   return -1;
 }
 
 void *respond_to_request(void *arg) {
-  int res_fd = (int)(uintptr_t)arg;
+  connection_t conn = {.id = atomic_fetch_add(&next_connection_id, 1),
+                       .budget = {.limit = POOL_CONNECTION_LIMIT},
+                       .timer = {.expire = expire_connection}};
   request_header_t header;
-  char *buffer = NULL;
-  string_t body = EMPTY_STRING;
-  sqlite3 *db;
-  db = database_create_connection("streaming.db");
-  when_null_jmp(db, disconnect, "Failed to connect to database. Exiting.\n");
-
-  // Read headers until connection is closed
-  while (0 == receive_header(res_fd, &header, sizeof(request_header_t))) {
+  char *buffer;
+  string_t body;
+  unsigned long requests = 0;
+  uint64_t arrival_ns = 0, receive_ns;
+  sched_class_e class;
+  unsigned cost;
+  channel_init(&conn.channel, (int)(uintptr_t)arg);
+  scheduler_client_init(&conn.sched);
+  conn.db = database_create_connection("streaming.db");
+  when_null_jmp(conn.db, close, "Failed to connect to database. Exiting.\n");
+  if (slowlog_enabled())
+    slowlog_watch(conn.db, &conn.slow);
+
+  // Read headers until connection is closed or stays idle for too long
+  timer_wheel_arm(&conn.timer, idle_timeout_s * 1000);
+  while (0 ==
+         channel_recv(&conn.channel, &header, sizeof(request_header_t))) {
+    if (trace_enabled())
+      arrival_ns = trace_clock();
     fprintf(stderr, "INFO: Header received.\n");
+    slowlog_begin(&conn.slow, header.command, header.body_size);
+    receive_ns = slowlog_clock();
+    buffer = NULL;
+    body = EMPTY_STRING;
     if (header.body_size > 0) {
-      buffer = receive_body(res_fd, header.body_size);
-      when_null_jmp(buffer, close, "Error: Failed to receive request body.\n");
-      // Frees the previous body and take ownership of the new one
-      string_init_take(&body, buffer, header.body_size);
+      timer_wheel_arm(&conn.timer, read_timeout_s * 1000);
+      // Null terminated body in a buffer reused across requests
+      buffer = pool_alloc(&conn.budget, header.body_size + 1);
+      when_null_jmp(buffer, disconnect,
+                    "Error: Failed to allocate request body.\n");
+      if (0 != channel_recv(&conn.channel, buffer, header.body_size)) {
+        fprintf(stderr, "Error: Failed to receive request body.\n");
+        pool_free(&conn.budget, buffer);
+        goto disconnect;
+      }
+      buffer[header.body_size] = '\0';
+      string_init_view(&body, buffer, header.body_size);
       fprintf(stderr, "INFO: Body received.\n");
     }
-    // Execute the command given by header and body and write response to res_fd
-    execute_command(header.command, body, db, res_fd);
+    conn.slow.phase_ns[SLOW_RECEIVE] = slowlog_clock() - receive_ns;
+    if (trace_enabled())
+      trace_request(conn.id, header, body.str, arrival_ns);
+    // Execute the command given by header and body and write response to fd
+    timer_wheel_cancel(&conn.timer);
+    // Wait for the turn of the request, among those of other connections
+    class = scheduler_classify(header.command, body, &cost);
+    scheduler_acquire(&conn.sched, class, cost);
+    // Watchers wait for changes rather than load the database
+    if (header.command != WATCH)
+      backup_request_started();
+    // The response is encoded in a pooled frame, or on the heap without it
+    conn.frame = pool_alloc(&conn.budget, RESPONSE_FRAME_SIZE);
+    execute_command(header.command, body, &conn);
+    pool_free(&conn.budget, conn.frame);
+    conn.frame = NULL;
+    scheduler_release(&conn.sched);
+    if (header.command != WATCH) {
+      backup_request_finished();
+      slowlog_end(conn.db, &conn.slow);
+    }
+    pool_free(&conn.budget, buffer);
+    requests++;
+    // Requests already received are dropped with a client that timed out
+    if (atomic_load(&conn.timed_out))
+      break;
+    timer_wheel_arm(&conn.timer, idle_timeout_s * 1000);
   }
-  // Frees the last body
-  string_deinit(&body);
 disconnect:
-  database_close_connection(db);
+  timer_wheel_cancel(&conn.timer);
+  if (trace_enabled())
+    trace_flush();
+  if (atomic_load(&conn.timed_out))
+    fprintf(stderr, "WARNING: Connection closed after a timeout\n");
+  fprintf(stderr,
+          "INFO: %lu requests served with %lu pool misses "
+          "(%lu process wide)\n",
+          requests, conn.budget.heap_allocations, pool_heap_allocations());
+  database_close_connection(conn.db);
 close:
-  close(res_fd);
+  pool_thread_release();
+  scheduler_client_deinit(&conn.sched);
+  channel_close(&conn.channel);
   return NULL;
 }
 
-int main(void) {
-  // Creation of the server socket
+static void set_keepalive(int fd) {
+  int option = 1;
+  setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &option, sizeof(option));
+  setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &KEEPALIVE_IDLE_S,
+             sizeof(KEEPALIVE_IDLE_S));
+  setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &KEEPALIVE_INTERVAL_S,
+             sizeof(KEEPALIVE_INTERVAL_S));
+  setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &KEEPALIVE_COUNT,
+             sizeof(KEEPALIVE_COUNT));
+}
+
+static int parse_duration(const char *arg, unsigned int *duration) {
+  char *endptr;
+  unsigned long value = strtoul(arg, &endptr, 10);
+  if (*arg == '\0' || *endptr != '\0' || value == 0 ||
+      value > UINT32_MAX / 1000)
+    return -1;
+  *duration = value;
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  // Parse the timeouts and the trace to record from the command line
+  int opt;
+  unsigned int threshold_ms;
+  while (-1 != (opt = getopt(argc, argv, "b:B:i:r:S:t:u:w:"))) {
+    switch (opt) {
+    case 'b':
+      if (0 != parse_duration(optarg, &backup_interval_s))
+        goto usage;
+      break;
+    case 'B':
+      backup_path = optarg;
+      break;
+    case 'i':
+      if (0 != parse_duration(optarg, &idle_timeout_s))
+        goto usage;
+      break;
+    case 'r':
+      if (0 != parse_duration(optarg, &read_timeout_s))
+        goto usage;
+      break;
+    case 'u':
+      unix_path = optarg;
+      break;
+    case 'w':
+      if (0 != parse_duration(optarg, &write_timeout_s))
+        goto usage;
+      break;
+    case 'S':
+      if (0 != parse_duration(optarg, &threshold_ms))
+        goto usage;
+      slowlog_set_threshold(threshold_ms);
+      break;
+    case 't':
+      if (0 != trace_open(optarg))
+        return EXIT_FAILURE;
+      break;
+    default:
+      goto usage;
+    }
+  }
+  // A write to a peer gone or shut down by a timer fails instead of killing
+  // the server
+  signal(SIGPIPE, SIG_IGN);
+  if (0 != timer_wheel_start())
+    return EXIT_FAILURE;
+  scheduler_init();
+  // Count the films already stored, the writes keep the counters up to date
+  sqlite3 *db = database_create_connection("streaming.db");
+  if (db == NULL || 0 != aggregate_rebuild(db))
+    return EXIT_FAILURE;
+  database_close_connection(db);
+  if (backup_interval_s != 0 &&
+      0 != backup_start_periodic("streaming.db", backup_path,
+                                 backup_interval_s))
+    return EXIT_FAILURE;
+
+  // Creation of the server sockets
   struct sockaddr_in servaddr;
-  int sock_fd = socket(PF_INET, SOCK_STREAM, 0);
+  struct sockaddr_un unixaddr;
+  struct pollfd listeners[2] = {{.fd = socket(PF_INET, SOCK_STREAM, 0),
+                                 .events = POLLIN},
+                                {.fd = socket(PF_UNIX, SOCK_STREAM, 0),
+                                 .events = POLLIN}};
+  int sock_fd = listeners[0].fd, unix_fd = listeners[1].fd;
   int option = 1;
   setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
-  if (-1 == sock_fd) {
+  if (-1 == sock_fd || -1 == unix_fd) {
     perror("socket");
-    return EXIT_FAILURE;
+    goto error;
   }
 
   // Listen on SERV_PORT
@@ -167,27 +551,65 @@ int main(void) {
     goto error;
   }
 
+  // Listen on unix_path, replacing the socket left by a previous run
+  memset(&unixaddr, 0, sizeof(unixaddr));
+  unixaddr.sun_family = AF_UNIX;
+  if (strlen(unix_path) >= sizeof(unixaddr.sun_path)) {
+    fprintf(stderr, "ERROR: Socket path too long: %s\n", unix_path);
+    goto error;
+  }
+  strcpy(unixaddr.sun_path, unix_path);
+  unlink(unix_path);
+  if (-1 == bind(unix_fd, (struct sockaddr *)&unixaddr, sizeof(unixaddr))) {
+    perror("bind");
+    goto error;
+  }
+  if (-1 == listen(unix_fd, SOMAXCONN)) {
+    perror("listen");
+    goto error;
+  }
+
   // ACCEPT INCOMING REQUESTS
-  struct sockaddr_in cliaddr;
   pthread_t thread;
   while (1) {
-    socklen_t clilen = sizeof(cliaddr);
-    int res_fd = accept(sock_fd, (struct sockaddr *)&cliaddr, &clilen);
-    if (-1 == res_fd) {
-      perror("accept");
+    if (-1 == poll(listeners, 2, -1)) {
+      perror("poll");
       goto error;
     }
-    fprintf(stderr, "INFO: A new client connected\n");
-    // Create a new thread and pass it the socket file descriptor
-    pthread_create(&thread, NULL, respond_to_request,
-                   (void *)(uintptr_t)res_fd);
-    pthread_detach(thread);
+    for (int i = 0; i < 2; i++) {
+      if (listeners[i].revents == 0)
+        continue;
+      int res_fd = accept(listeners[i].fd, NULL, NULL);
+      if (-1 == res_fd) {
+        perror("accept");
+        goto error;
+      }
+      fprintf(stderr, "INFO: A new client connected\n");
+      if (listeners[i].fd == sock_fd)
+        set_keepalive(res_fd);
+      // Create a new thread and pass it the socket file descriptor
+      pthread_create(&thread, NULL, respond_to_request,
+                     (void *)(uintptr_t)res_fd);
+      pthread_detach(thread);
+    }
   }
 
   close(sock_fd);
+  close(unix_fd);
   return EXIT_SUCCESS;
 
 error:
   close(sock_fd);
+  close(unix_fd);
+  trace_close();
+  return EXIT_FAILURE;
+
+usage:
+  fprintf(stderr,
+          "Usage: %s [-b backup interval (s)] [-B backup path] "
+          "[-i idle timeout (s)] [-r read timeout (s)] "
+          "[-S slow request threshold (ms)] [-t request trace file] "
+          "[-u unix socket path] [-w write timeout (s)]\n",
+          argv[0]);
   return EXIT_FAILURE;
 }
@@ -0,0 +1,136 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "slowlog.h"
+#include "request.h"
+#include "when_macros.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static struct {
+  pthread_mutex_t lock;
+  uint64_t threshold_ns; // Set before the connections start, 0 if disabled
+  uint64_t logged;       // Slow requests logged since the start
+  slow_request_t ring[SLOWLOG_LEN]; // Request n is at n % len
+} slowlog = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+void slowlog_set_threshold(unsigned threshold_ms) {
+  slowlog.threshold_ns = (uint64_t)threshold_ms * 1000000;
+}
+
+int slowlog_enabled(void) { return slowlog.threshold_ns != 0; }
+
+uint64_t slowlog_clock(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Called by sqlite when a statement of the connection ends
+static int profile(unsigned type, void *context, void *p, void *x) {
+  slow_request_t *request = context;
+  sqlite3_stmt *stmt = p;
+  uint64_t ns = *(sqlite3_uint64 *)x;
+  if (type != SQLITE_TRACE_PROFILE || !request->recording)
+    return 0;
+  request->rows_scanned +=
+      sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 0);
+  request->vm_steps += sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, 0);
+  if (request->sql[0] == '\0' || ns > request->statement_ns) {
+    request->statement_ns = ns;
+    snprintf(request->sql, SLOWLOG_SQL_MAX_LEN, "%s", sqlite3_sql(stmt));
+  }
+  return 0;
+}
+
+void slowlog_watch(sqlite3 *db, slow_request_t *request) {
+  request->recording = 0;
+  sqlite3_trace_v2(db, SQLITE_TRACE_PROFILE, profile, request);
+}
+
+void slowlog_begin(slow_request_t *request, uint16_t command,
+                   uint16_t request_size) {
+  request->recording = slowlog_enabled();
+  request->command = command;
+  request->request_size = request_size;
+  request->response_size = 0;
+  for (int phase = 0; phase < SLOW_PHASES; phase++)
+    request->phase_ns[phase] = 0;
+  request->rows_scanned = request->vm_steps = request->statement_ns = 0;
+  request->sql[0] = '\0';
+}
+
+// Describe the plan of the slowest statement, parameters being unbound
+static void explain(sqlite3 *db, slow_request_t *request) {
+  sqlite3_stmt *stmt = NULL;
+  size_t len = 0;
+  request->plan[0] = '\0';
+  char *query = sqlite3_mprintf("EXPLAIN QUERY PLAN %s", request->sql);
+  if (query == NULL)
+    return;
+  if (SQLITE_OK == sqlite3_prepare_v2(db, query, -1, &stmt, NULL))
+    while (len < SLOWLOG_PLAN_MAX_LEN && SQLITE_ROW == sqlite3_step(stmt))
+      len += snprintf(request->plan + len, SLOWLOG_PLAN_MAX_LEN - len, "%s%s",
+                      len > 0 ? "; " : "", sqlite3_column_text(stmt, 3));
+  sqlite3_finalize(stmt);
+  sqlite3_free(query);
+}
+
+void slowlog_end(sqlite3 *db, slow_request_t *request) {
+  uint64_t total_ns = 0;
+  if (!request->recording)
+    return;
+  request->recording = 0;
+  for (int phase = 0; phase < SLOW_PHASES; phase++)
+    total_ns += request->phase_ns[phase];
+  if (total_ns < slowlog.threshold_ns)
+    return;
+  explain(db, request);
+  fprintf(stderr,
+          "WARNING: Slow request: command n°%hu took %" PRIu64
+          " us, %" PRIu64 " rows scanned%s%s%s\n",
+          request->command, total_ns / 1000, request->rows_scanned,
+          request->sql[0] != '\0' ? " by \"" : "", request->sql,
+          request->sql[0] != '\0' ? "\"" : "");
+  pthread_mutex_lock(&slowlog.lock);
+  slowlog.ring[slowlog.logged++ % SLOWLOG_LEN] = *request;
+  pthread_mutex_unlock(&slowlog.lock);
+}
+
+// One record per slow request, newest first, as long as they fit a body:
+// command, request and response sizes, time of each phase (us), rows
+// scanned, virtual machine steps, slowest statement and its plan
+int slowlog_encode(string_t *body, int *count) {
+  size_t len = 0;
+  int n;
+  *count = 0;
+  char *buffer = malloc(RESPONSE_BODY_MAX);
+  when_null_ret(buffer, -1, "ERROR: Failed to allocate slow log\n");
+  pthread_mutex_lock(&slowlog.lock);
+  for (uint64_t i = slowlog.logged;
+       i > 0 && i + SLOWLOG_LEN > slowlog.logged; i--) {
+    const slow_request_t *request = &slowlog.ring[(i - 1) % SLOWLOG_LEN];
+    n = snprintf(buffer + len, RESPONSE_BODY_MAX - len,
+                 "%s%hu\x1F%hu\x1F%hu\x1F%" PRIu64 "\x1F%" PRIu64
+                 "\x1F%" PRIu64 "\x1F%" PRIu64 "\x1F%" PRIu64 "\x1F%" PRIu64
+                 "\x1F%s\x1F%s",
+                 len > 0 ? "\x1E" : "", request->command,
+                 request->request_size, request->response_size,
+                 request->phase_ns[SLOW_RECEIVE] / 1000,
+                 request->phase_ns[SLOW_DATABASE] / 1000,
+                 request->phase_ns[SLOW_ENCODE] / 1000,
+                 request->phase_ns[SLOW_SEND] / 1000, request->rows_scanned,
+                 request->vm_steps, request->sql, request->plan);
+    if (n < 0 || (size_t)n >= RESPONSE_BODY_MAX - len)
+      break; // The record did not fit, drop it and the older ones
+    len += n;
+    (*count)++;
+  }
+  pthread_mutex_unlock(&slowlog.lock);
+  buffer[len] = '\0';
+  string_init_take(body, buffer, len);
+  return 0;
+}
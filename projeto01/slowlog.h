@@ -0,0 +1,65 @@
+#ifndef SLOWLOG_H
+#define SLOWLOG_H
+
+#include "string.h"
+#include <sqlite3.h>
+#include <stdint.h>
+
+/**
+ * @file slowlog.h
+ * @brief Log of the requests slower than a threshold
+ * The time of a request is split into phases, and the statements it runs
+ * are profiled through sqlite3_trace_v2. A request slower than the
+ * threshold is kept, with the query plan of its slowest statement, in a
+ * bounded ring retrieved with the SLOW_LOG command.
+ */
+
+#define SLOWLOG_LEN 128
+#define SLOWLOG_SQL_MAX_LEN 256
+#define SLOWLOG_PLAN_MAX_LEN 512
+
+enum slow_phase {
+  SLOW_RECEIVE,  // Reading the request body
+  SLOW_DATABASE, // database_* call, including the encoding of listed rows
+  SLOW_ENCODE,   // Framing the response
+  SLOW_SEND,     // Writing the response to the client
+  SLOW_PHASES,
+};
+
+typedef enum slow_phase slow_phase_e;
+
+/**
+ * @struct slow_request
+ * @brief Measures of a request
+ */
+struct slow_request {
+  int recording;                     /**< Are statements being profiled */
+  uint16_t command;                  /**< Command of the request */
+  uint16_t request_size;             /**< Size of the request body */
+  uint16_t response_size;            /**< Size of the response body */
+  uint64_t phase_ns[SLOW_PHASES];    /**< Time spent in each phase */
+  uint64_t rows_scanned;             /**< Steps of full table scans */
+  uint64_t vm_steps;                 /**< Virtual machine instructions */
+  uint64_t statement_ns;             /**< Time of the slowest statement */
+  char sql[SLOWLOG_SQL_MAX_LEN];     /**< Slowest statement */
+  char plan[SLOWLOG_PLAN_MAX_LEN];   /**< Its query plan, once logged */
+};
+
+typedef struct slow_request slow_request_t;
+
+void slowlog_set_threshold(unsigned threshold_ms);
+
+int slowlog_enabled(void);
+
+uint64_t slowlog_clock(void);
+
+void slowlog_watch(sqlite3 *db, slow_request_t *request);
+
+void slowlog_begin(slow_request_t *request, uint16_t command,
+                   uint16_t request_size);
+
+void slowlog_end(sqlite3 *db, slow_request_t *request);
+
+int slowlog_encode(string_t *body, int *count);
+
+#endif // !SLOWLOG_H
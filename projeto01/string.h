@@ -2,10 +2,17 @@
 #define STRING_H
 
 #include "when_macros.h"
+#include <limits.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 /**
  * @file string.h
  * @brief Managed string with length
@@ -13,8 +20,9 @@
  * @ingroup string
  */
 
-#define EMPTY_STRING_INIT {.str = NULL, .len = 0, .allocated = 0}
-#define EMPTY_STRING (string_t){.str = NULL, .len = 0, .allocated = 0}
+#define EMPTY_STRING_INIT {.str = NULL, .len = 0, .allocated = 0, .capacity = 0}
+#define EMPTY_STRING                                                           \
+  (string_t){.str = NULL, .len = 0, .allocated = 0, .capacity = 0}
 
 /**
  * @defgroup string Managed strings
@@ -36,6 +44,7 @@ struct string {
   char *str;      /**< Start of the string */
   size_t len;     /**< Length of the string */
   char allocated; /**< Does the string need to be freed */
+  size_t capacity; /**< Size of a fixed buffer not owned by the string */
 };
 
 static inline void string_init_view(string_t *str, const char *view,
@@ -43,6 +52,16 @@ static inline void string_init_view(string_t *str, const char *view,
   *str = (string_t){.str = (char *)view, .len = len, .allocated = 0};
 }
 
+/**
+ * @brief Make the string an empty string written in place into buffer
+ * Joins then never reallocate and fail once capacity bytes are used.
+ */
+static inline void string_init_buffer(string_t *str, char *buffer,
+                                      size_t capacity) {
+  *str = (string_t){
+      .str = buffer, .len = 0, .allocated = 0, .capacity = capacity};
+}
+
 static inline void string_init_take(string_t *str, char *buffer, size_t len) {
   if (str->allocated)
     free(str->str);
@@ -55,37 +74,145 @@ static inline void string_deinit(string_t *string) {
   *string = EMPTY_STRING;
 }
 
-static inline string_t string_split(char token, const string_t *string) {
-  static string_t remaining = EMPTY_STRING_INIT;
-  string_t result;
-  if (string != NULL)
-    remaining = *string;
-  if (remaining.str == NULL || remaining.len == 0)
-    return EMPTY_STRING;
-  for (unsigned i = 0; i < remaining.len; i++) {
-    if (remaining.str[i] == token) {
-      string_init_view(&result, remaining.str, i);
-      remaining.len -= i + 1;
-      remaining.str += i + 1;
-      return result;
-    }
+/**
+ * @typedef string_tokenizer_t
+ * @brief Typedef for the string tokenizer structure
+ *
+ */
+typedef struct string_tokenizer string_tokenizer_t;
+
+/**
+ * @struct string_tokenizer
+ * @brief Cursor over the tokens of a string
+ * A string holding n separators has n + 1 tokens, an empty string has none.
+ * Tokens are views on the string, which must outlive them.
+ */
+struct string_tokenizer {
+  const char *cursor; /**< Start of the next token */
+  const char *end;    /**< End of the tokenized string */
+  char separator;     /**< Separator ending the last token, 0 at the end */
+  char done;          /**< Was the last token returned */
+};
+
+static inline void string_tokenizer_init(string_tokenizer_t *tokenizer,
+                                         string_t string) {
+  *tokenizer = (string_tokenizer_t){.cursor = string.str,
+                                    .end = string.str + string.len,
+                                    .separator = 0,
+                                    .done = (string.len == 0)};
+}
+
+/**
+ * @brief Find the first of two bytes in [begin, end)
+ * Scans 32 (AVX2) or 16 (SSE2) bytes at a time when available.
+ * @return the position of the byte, or end when neither is found
+ */
+static inline const char *string_find_any(const char *begin, const char *end,
+                                          char a, char b) {
+  const char *p = begin;
+#if defined(__AVX2__)
+  const __m256i wide_a = _mm256_set1_epi8(a), wide_b = _mm256_set1_epi8(b);
+  for (; end - p >= 32; p += 32) {
+    __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+    unsigned mask = (unsigned)_mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(chunk, wide_a),
+                        _mm256_cmpeq_epi8(chunk, wide_b)));
+    if (mask != 0)
+      return p + __builtin_ctz(mask);
   }
-  result = remaining;
-  remaining = EMPTY_STRING;
-  return result;
+#endif
+#if defined(__SSE2__)
+  const __m128i vec_a = _mm_set1_epi8(a), vec_b = _mm_set1_epi8(b);
+  for (; end - p >= 16; p += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(
+        _mm_cmpeq_epi8(chunk, vec_a), _mm_cmpeq_epi8(chunk, vec_b)));
+    if (mask != 0)
+      return p + __builtin_ctz(mask);
+  }
+#endif
+  for (; p < end; p++) {
+    if (*p == a || *p == b)
+      return p;
+  }
+  return end;
 }
 
-static inline void string_join(string_t *left, char token,
-                               const string_t right) {
+static inline int string_tokenize_until(string_tokenizer_t *tokenizer,
+                                        const char *separator,
+                                        string_t *token) {
+  if (tokenizer->done) {
+    *token = EMPTY_STRING;
+    return 0;
+  }
+  if (separator == NULL) {
+    separator = tokenizer->end;
+    tokenizer->separator = 0;
+    tokenizer->done = 1;
+  } else {
+    tokenizer->separator = *separator;
+  }
+  string_init_view(token, tokenizer->cursor, separator - tokenizer->cursor);
+  tokenizer->cursor = separator + (separator != tokenizer->end);
+  return 1;
+}
+
+/**
+ * @brief Get the next token ended by the separator or the end of the string
+ * @return 1 and a view on the token, or 0 and an empty string at the end
+ */
+static inline int string_tokenize(string_tokenizer_t *tokenizer,
+                                  char separator, string_t *token) {
+  const char *found =
+      tokenizer->done
+          ? NULL
+          : memchr(tokenizer->cursor, separator,
+                   tokenizer->end - tokenizer->cursor);
+  return string_tokenize_until(tokenizer, found, token);
+}
+
+/**
+ * @brief Get the next token ended by either separator or the end of the
+ * string, the separator found is kept in tokenizer->separator
+ * @return 1 and a view on the token, or 0 and an empty string at the end
+ */
+static inline int string_tokenize_any(string_tokenizer_t *tokenizer, char a,
+                                      char b, string_t *token) {
+  const char *found = NULL;
+  if (!tokenizer->done) {
+    found = string_find_any(tokenizer->cursor, tokenizer->end, a, b);
+    if (found == tokenizer->end)
+      found = NULL;
+  }
+  return string_tokenize_until(tokenizer, found, token);
+}
+
+/**
+ * @brief Append the token and right to left
+ * @return 0, or -1 when a fixed buffer has no room left, left being unchanged
+ */
+static inline int string_join(string_t *left, char token,
+                              const string_t right) {
   // If right string is empty nothing happens
   if (right.str == NULL || right.len == 0)
-    return;
+    return 0;
+  // A fixed buffer is written in place, the token only between strings
+  if (left->capacity != 0) {
+    size_t len = left->len + (left->len > 0) + right.len;
+    if (len > left->capacity)
+      return -1;
+    if (left->len > 0)
+      left->str[left->len++] = token;
+    memcpy(left->str + left->len, right.str, right.len);
+    left->len = len;
+    return 0;
+  }
   // If left string is empty it becomes a view on the right string
   if (left->str == NULL) {
     left->str = right.str;
     left->len = right.len;
     left->allocated = 0;
-    return;
+    return 0;
   }
   // Realloc space for both string + token + null terminator
   size_t len = left->len + right.len + 2;
@@ -95,19 +222,48 @@ static inline void string_join(string_t *left, char token,
     char *buffer = (char *)malloc(len);
     memcpy(buffer, left->str, left->len);
     left->str = buffer;
+    left->allocated = 1;
   }
   left->str[left->len] = token;
   memcpy(left->str + left->len + 1, right.str, right.len);
   left->str[left->len + 1 + right.len] = '\0';
   left->len += 1 + right.len;
-  return;
+  return 0;
+}
+
+/**
+ * @brief Get room for len bytes and a null byte as the whole string, in its
+ * fixed buffer when it fits, else in a new allocation
+ * @return the start of the string, or NULL when the allocation failed
+ */
+static inline char *string_reserve(string_t *str, size_t len) {
+  if (str->capacity != 0 && len < str->capacity) {
+    str->len = len;
+    return str->str;
+  }
+  char *buffer = malloc(len + 1);
+  if (buffer != NULL)
+    string_init_take(str, buffer, len);
+  return buffer;
 }
 
+// Parse the whole string as a decimal integer, without reading past its end
 static inline int string_to_integer(string_t string, int *value) {
-  char *endptr;
-  *value = strtol(string.str, &endptr, 10);
-  if (*value == 0 && string.str + string.len != endptr)
+  size_t i = 0;
+  long long result = 0;
+  int negative = 0;
+  if (string.len > 0 && (string.str[0] == '-' || string.str[0] == '+'))
+    negative = (string.str[i++] == '-');
+  if (i == string.len)
     return -1;
+  for (; i < string.len; i++) {
+    if (string.str[i] < '0' || string.str[i] > '9')
+      return -1;
+    result = result * 10 + (string.str[i] - '0');
+    if (result > (long long)INT_MAX + negative)
+      return -1;
+  }
+  *value = (int)(negative ? -result : result);
   return 0;
 }
 
@@ -0,0 +1,130 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "timer_wheel.h"
+#include "when_macros.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define MAX_TIMEOUT_TICKS                                                      \
+  ((UINT64_C(1) << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+// Each slot is a circular list whose head is a sentinel timer
+static struct {
+  pthread_mutex_t lock;
+  uint64_t now; // Last tick processed
+  wheel_timer_t slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} wheel = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static inline void unlink_timer(wheel_timer_t *timer) {
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->next = timer->prev = NULL;
+}
+
+static void insert_timer(wheel_timer_t *timer) {
+  uint64_t delta = timer->expires - wheel.now;
+  unsigned level = 0;
+  while (level < TIMER_WHEEL_LEVELS - 1 &&
+         delta >> (TIMER_WHEEL_SLOT_BITS * (level + 1)) != 0)
+    level++;
+  unsigned index =
+      (timer->expires >> (TIMER_WHEEL_SLOT_BITS * level)) & SLOT_MASK;
+  wheel_timer_t *head = &wheel.slots[level][index];
+  timer->next = head;
+  timer->prev = head->prev;
+  head->prev->next = timer;
+  head->prev = timer;
+}
+
+// Move the timers of a coarse slot to the finer levels, returns its index
+static unsigned cascade(unsigned level) {
+  unsigned index =
+      (wheel.now >> (TIMER_WHEEL_SLOT_BITS * level)) & SLOT_MASK;
+  wheel_timer_t *head = &wheel.slots[level][index];
+  wheel_timer_t *timer;
+  while (head->next != head) {
+    timer = head->next;
+    unlink_timer(timer);
+    insert_timer(timer);
+  }
+  return index;
+}
+
+static void advance(void) {
+  wheel.now++;
+  unsigned index = wheel.now & SLOT_MASK;
+  for (unsigned level = 1; index == 0 && level < TIMER_WHEEL_LEVELS; level++)
+    index = cascade(level);
+
+  wheel_timer_t *head = &wheel.slots[0][wheel.now & SLOT_MASK];
+  wheel_timer_t *timer;
+  while (head->next != head) {
+    timer = head->next;
+    unlink_timer(timer);
+    timer->expire(timer);
+  }
+}
+
+static uint64_t current_tick(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t elapsed_ms = (now.tv_sec - start->tv_sec) * 1000 +
+                        (now.tv_nsec - start->tv_nsec) / 1000000;
+  return elapsed_ms / TIMER_WHEEL_TICK_MS;
+}
+
+static void *run_wheel([[maybe_unused]] void *arg) {
+  struct timespec start;
+  const struct timespec tick = {.tv_sec = 0,
+                                .tv_nsec = TIMER_WHEEL_TICK_MS * 1000000L};
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while (1) {
+    nanosleep(&tick, NULL);
+    // Catch up on the ticks missed while sleeping longer than expected
+    uint64_t target = current_tick(&start);
+    pthread_mutex_lock(&wheel.lock);
+    while (wheel.now < target)
+      advance();
+    pthread_mutex_unlock(&wheel.lock);
+  }
+  return NULL;
+}
+
+int timer_wheel_start(void) {
+  pthread_t thread;
+  for (unsigned level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    for (unsigned index = 0; index < TIMER_WHEEL_SLOTS; index++) {
+      wheel_timer_t *head = &wheel.slots[level][index];
+      head->next = head->prev = head;
+    }
+  }
+  int rc = pthread_create(&thread, NULL, run_wheel, NULL);
+  when_true_ret(0 != rc, -1, "ERROR: Failed to start the timer wheel\n");
+  pthread_detach(thread);
+  return 0;
+}
+
+void timer_wheel_arm(wheel_timer_t *timer, unsigned timeout_ms) {
+  uint64_t ticks = (timeout_ms + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+  if (ticks == 0)
+    ticks = 1;
+  if (ticks > MAX_TIMEOUT_TICKS)
+    ticks = MAX_TIMEOUT_TICKS;
+  pthread_mutex_lock(&wheel.lock);
+  if (timer->next != NULL)
+    unlink_timer(timer);
+  timer->expires = wheel.now + ticks;
+  insert_timer(timer);
+  pthread_mutex_unlock(&wheel.lock);
+}
+
+// Once cancelled, the expiry callback of the timer is guaranteed not to run
+void timer_wheel_cancel(wheel_timer_t *timer) {
+  pthread_mutex_lock(&wheel.lock);
+  if (timer->next != NULL)
+    unlink_timer(timer);
+  pthread_mutex_unlock(&wheel.lock);
+}
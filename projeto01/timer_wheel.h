@@ -0,0 +1,40 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+/**
+ * @file timer_wheel.h
+ * @brief Hierarchical timer wheel
+ * Timers are hashed by expiry tick into TIMER_WHEEL_LEVELS wheels of
+ * TIMER_WHEEL_SLOTS slots, each level being TIMER_WHEEL_SLOTS times coarser
+ * than the previous one. Arming, re-arming and cancelling a timer are O(1),
+ * and a tick only touches the timers of the current slot, so tracking a
+ * large number of idle connections costs nothing until they expire.
+ */
+
+#define TIMER_WHEEL_TICK_MS 100
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+typedef struct wheel_timer wheel_timer_t;
+
+/**
+ * @struct wheel_timer
+ * @brief A timer, usually embedded in the structure it watches
+ */
+struct wheel_timer {
+  wheel_timer_t *next;                  /**< Next timer in the slot */
+  wheel_timer_t *prev;                  /**< Previous timer in the slot */
+  uint64_t expires;                     /**< Tick of expiry */
+  void (*expire)(wheel_timer_t *timer); /**< Called from the wheel thread */
+};
+
+int timer_wheel_start(void);
+
+void timer_wheel_arm(wheel_timer_t *timer, unsigned timeout_ms);
+
+void timer_wheel_cancel(wheel_timer_t *timer);
+
+#endif // !TIMER_WHEEL_H
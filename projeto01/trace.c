@@ -0,0 +1,87 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "trace.h"
+#include "when_macros.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Records are buffered by stdio and flushed at least every second
+#define TRACE_BUFFER_SIZE (1 << 20)
+#define TRACE_FLUSH_INTERVAL_NS 1000000000ULL
+
+static struct {
+  pthread_mutex_t lock;
+  FILE *file;
+  uint64_t start_ns; // Monotonic time of the start of the recording
+  uint64_t flush_ns; // Time of the last flush since the start
+  char buffer[TRACE_BUFFER_SIZE];
+} trace = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static inline uint64_t clock_ns(clockid_t clock) {
+  struct timespec now;
+  clock_gettime(clock, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+int trace_open(const char *path) {
+  trace.file = fopen(path, "wb");
+  when_null_ret(trace.file, -1, "ERROR: Failed to open trace %s\n", path);
+  setvbuf(trace.file, trace.buffer, _IOFBF, TRACE_BUFFER_SIZE);
+  trace_header_t header = {.version = TRACE_VERSION,
+                           .start_ns = clock_ns(CLOCK_REALTIME)};
+  memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+  trace.start_ns = clock_ns(CLOCK_MONOTONIC);
+  if (1 != fwrite(&header, sizeof(header), 1, trace.file)) {
+    fprintf(stderr, "ERROR: Failed to write trace header\n");
+    trace_close();
+    return -1;
+  }
+  fflush(trace.file);
+  fprintf(stderr, "INFO: Recording requests to %s\n", path);
+  return 0;
+}
+
+int trace_enabled(void) { return trace.file != NULL; }
+
+uint64_t trace_clock(void) {
+  return clock_ns(CLOCK_MONOTONIC) - trace.start_ns;
+}
+
+void trace_request(uint32_t connection, request_header_t header,
+                   const char *body, uint64_t arrival_ns) {
+  trace_record_t record = {.arrival_ns = arrival_ns,
+                           .connection = connection,
+                           .command = header.command,
+                           .body_size = body ? header.body_size : 0};
+  if (trace_is_transport(header.command))
+    return;
+  pthread_mutex_lock(&trace.lock);
+  if (trace.file == NULL)
+    goto end;
+  fwrite(&record, sizeof(record), 1, trace.file);
+  if (record.body_size > 0)
+    fwrite(body, 1, record.body_size, trace.file);
+  if (arrival_ns > trace.flush_ns + TRACE_FLUSH_INTERVAL_NS) {
+    fflush(trace.file);
+    trace.flush_ns = arrival_ns;
+  }
+end:
+  pthread_mutex_unlock(&trace.lock);
+}
+
+void trace_flush(void) {
+  pthread_mutex_lock(&trace.lock);
+  if (trace.file != NULL)
+    fflush(trace.file);
+  pthread_mutex_unlock(&trace.lock);
+}
+
+void trace_close(void) {
+  pthread_mutex_lock(&trace.lock);
+  if (trace.file != NULL)
+    fclose(trace.file);
+  trace.file = NULL;
+  pthread_mutex_unlock(&trace.lock);
+}
@@ -0,0 +1,62 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "request.h"
+#include <stdint.h>
+
+/**
+ * @file trace.h
+ * @brief Append-only trace of the requests received by the server
+ * A trace starts with a trace_header, followed by one trace_record per
+ * request, each directly followed by the request body. Integers are stored
+ * in host byte order: traces are replayed from the recording host.
+ * Commands switching the connection to another transport are not recorded:
+ * a replay sends each request over TCP and waits for its single response.
+ */
+
+#define TRACE_MAGIC "FTRC"
+#define TRACE_VERSION 1
+
+/**
+ * @struct trace_header
+ * @brief Header of a trace file
+ */
+struct trace_header {
+  char magic[4];     /**< TRACE_MAGIC without its null terminator */
+  uint32_t version;  /**< TRACE_VERSION */
+  uint64_t start_ns; /**< Wall clock time of the start of the recording */
+};
+
+/**
+ * @struct trace_record
+ * @brief A recorded request
+ */
+struct trace_record {
+  uint64_t arrival_ns; /**< Arrival time since the start of the recording */
+  uint32_t connection; /**< Connection the request was received on */
+  uint16_t command;    /**< Command of the request */
+  uint16_t body_size;  /**< Size of the body following the record */
+};
+
+typedef struct trace_header trace_header_t;
+typedef struct trace_record trace_record_t;
+
+// Is the command a switch of transport rather than a replayable request
+static inline int trace_is_transport(uint16_t command) {
+  return command == WATCH || command == SHM_ATTACH;
+}
+
+int trace_open(const char *path);
+
+int trace_enabled(void);
+
+uint64_t trace_clock(void);
+
+void trace_request(uint32_t connection, request_header_t header,
+                   const char *body, uint64_t arrival_ns);
+
+void trace_flush(void);
+
+void trace_close(void);
+
+#endif // !TRACE_H
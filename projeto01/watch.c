@@ -0,0 +1,172 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "watch.h"
+#include "channel.h"
+#include "request.h"
+#include "timer_wheel.h"
+#include "when_macros.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Delay between two checks of a subscriber connection while no delta arrives
+#define WATCH_POLL_INTERVAL_S 1
+// Room for the sequence number, the delta kind and their separators
+#define DELTA_PREFIX_MAX_LEN 32
+
+struct delta {
+  uint64_t seq;
+  char *body;
+  size_t len;
+};
+
+static struct {
+  pthread_mutex_t publish_lock; // Held by a write until its delta is numbered
+  pthread_mutex_t lock;
+  pthread_cond_t published;
+  uint64_t next_seq; // Sequence number given to the next published delta
+  struct delta history[WATCH_HISTORY_LEN]; // Delta n is at n % len
+} watch = {
+    .publish_lock = PTHREAD_MUTEX_INITIALIZER,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .published = PTHREAD_COND_INITIALIZER,
+    .next_seq = 1,
+};
+
+int watch_encode_film(const film_t *film, string_t *record) {
+  int len = snprintf(NULL, 0, "%d\x1F%.*s\x1F%.*s\x1F%.*s\x1F%d", film->id,
+                     (int)film->title.len, film->title.str,
+                     (int)film->genre.len, film->genre.str,
+                     (int)film->director.len, film->director.str, film->year);
+  char *buffer = malloc(len + 1);
+  when_null_ret(buffer, -1, "ERROR: Failed to allocate delta record\n");
+  snprintf(buffer, len + 1, "%d\x1F%.*s\x1F%.*s\x1F%.*s\x1F%d", film->id,
+           (int)film->title.len, film->title.str, (int)film->genre.len,
+           film->genre.str, (int)film->director.len, film->director.str,
+           film->year);
+  string_init_take(record, buffer, len);
+  return 0;
+}
+
+void watch_lock_publish(void) { pthread_mutex_lock(&watch.publish_lock); }
+
+void watch_unlock_publish(void) { pthread_mutex_unlock(&watch.publish_lock); }
+
+void watch_publish(delta_kind_e kind, string_t record) {
+  // A delta must fit in a response body: a larger record only keeps the id
+  // of its film, which the client fetches again
+  if (DELTA_PREFIX_MAX_LEN + record.len > UINT16_MAX) {
+    const char *separator = memchr(record.str, '\x1F', record.len);
+    record.len = separator != NULL ? (size_t)(separator - record.str) : 0;
+  }
+  size_t size = DELTA_PREFIX_MAX_LEN + record.len + 1;
+  char *body = malloc(size);
+  if (body == NULL) {
+    fprintf(stderr, "ERROR: Failed to allocate delta (dropped)\n");
+    return;
+  }
+  pthread_mutex_lock(&watch.lock);
+  uint64_t seq = watch.next_seq++;
+  int len = snprintf(body, size, "%" PRIu64 "\x1F%hu\x1F%.*s", seq, kind,
+                     (int)record.len, record.str);
+  struct delta *slot = &watch.history[seq % WATCH_HISTORY_LEN];
+  free(slot->body);
+  *slot = (struct delta){.seq = seq, .body = body, .len = len};
+  pthread_cond_broadcast(&watch.published);
+  pthread_mutex_unlock(&watch.lock);
+}
+
+struct subscriber {
+  channel_t *channel;
+  wheel_timer_t *timer;  // Closes the connection of a subscriber not reading
+  unsigned timeout_ms;   // Time allowed to the subscriber to take a frame
+};
+
+static int send_frame(struct subscriber *subscriber, response_code_e code,
+                      const char *body, size_t len) {
+  response_header_t header = {code, 1, len, 0};
+  int rc = -1;
+  timer_wheel_arm(subscriber->timer, subscriber->timeout_ms);
+  if (0 == channel_send(subscriber->channel, &header,
+                        sizeof(response_header_t)))
+    rc = channel_send(subscriber->channel, body, len);
+  timer_wheel_cancel(subscriber->timer);
+  return rc;
+}
+
+static int send_seq(struct subscriber *subscriber, response_code_e code,
+                    uint64_t seq) {
+  char body[DELTA_PREFIX_MAX_LEN];
+  int len = snprintf(body, sizeof(body), "%" PRIu64, seq);
+  return send_frame(subscriber, code, body, len);
+}
+
+// A subscription ends when the client closes the connection or sends a new
+// request, which is then read by the usual request loop.
+static int subscriber_left(channel_t *channel) {
+  return channel_has_input(channel);
+}
+
+int watch_subscribe(channel_t *channel, uint64_t since, wheel_timer_t *timer,
+                    unsigned timeout_ms) {
+  struct subscriber subscriber = {channel, timer, timeout_ms};
+  struct timespec deadline;
+  struct delta delta;
+
+  pthread_mutex_lock(&watch.lock);
+  uint64_t cursor = watch.next_seq - 1; // Last delta sent to the subscriber
+  pthread_mutex_unlock(&watch.lock);
+  // Acknowledge with the current sequence number, resuming from `since`
+  if (0 != send_seq(&subscriber, NO_ERROR, cursor))
+    return -1;
+  if (since != 0)
+    cursor = since;
+  fprintf(stderr, "INFO: Watching catalog changes after n°%" PRIu64 "\n",
+          cursor);
+
+  while (!subscriber_left(channel)) {
+    pthread_mutex_lock(&watch.lock);
+    if (cursor + 1 >= watch.next_seq) {
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += WATCH_POLL_INTERVAL_S;
+      pthread_cond_timedwait(&watch.published, &watch.lock, &deadline);
+    }
+    uint64_t oldest = watch.next_seq > WATCH_HISTORY_LEN
+                          ? watch.next_seq - WATCH_HISTORY_LEN
+                          : 1;
+    if (cursor + 1 < oldest || cursor >= watch.next_seq) {
+      // Missed deltas are gone (or come from another server run): the
+      // client must fetch a snapshot and resume from the current sequence
+      cursor = watch.next_seq - 1;
+      pthread_mutex_unlock(&watch.lock);
+      fprintf(stderr,
+              "WARNING: Watcher fell behind, resync at n°%" PRIu64 "\n",
+              cursor);
+      if (0 != send_seq(&subscriber, WATCH_RESYNC, cursor))
+        return -1;
+      continue;
+    }
+    if (cursor + 1 == watch.next_seq) {
+      pthread_mutex_unlock(&watch.lock);
+      continue;
+    }
+    // Copy the delta so that it is sent without holding the lock
+    delta = watch.history[(cursor + 1) % WATCH_HISTORY_LEN];
+    delta.body = malloc(delta.len);
+    if (delta.body != NULL)
+      memcpy(delta.body, watch.history[(cursor + 1) % WATCH_HISTORY_LEN].body,
+             delta.len);
+    pthread_mutex_unlock(&watch.lock);
+    when_null_ret(delta.body, -1, "ERROR: Failed to allocate delta copy\n");
+    int rc = send_frame(&subscriber, WATCH_DELTA, delta.body, delta.len);
+    free(delta.body);
+    if (rc != 0)
+      return -1;
+    cursor = delta.seq;
+  }
+  fprintf(stderr, "INFO: Watch ended after n°%" PRIu64 "\n", cursor);
+  return 0;
+}
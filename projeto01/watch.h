@@ -0,0 +1,44 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "channel.h"
+#include "film.h"
+#include "string.h"
+#include "timer_wheel.h"
+#include <stdint.h>
+
+/**
+ * @file watch.h
+ * @brief Catalog change subscriptions
+ * Every committed write is recorded as a delta with a monotonically
+ * increasing sequence number. A watching connection is pushed the deltas
+ * it has not seen yet, and is told to resynchronise (by fetching a fresh
+ * snapshot) when it fell behind the retained history. A change too large
+ * for a response body is recorded with the id of its film only. A watcher
+ * that stops reading is closed by the timer of its connection.
+ * A write holds the publish lock from before its transaction until its
+ * delta is published, so that deltas are numbered in commit order.
+ */
+
+#define WATCH_HISTORY_LEN 1024
+
+enum delta_kind : uint16_t {
+  DELTA_CREATED,
+  DELTA_REMOVED,
+  DELTA_GENRE_ADDED,
+};
+
+typedef enum delta_kind delta_kind_e;
+
+int watch_encode_film(const film_t *film, string_t *record);
+
+void watch_lock_publish(void);
+
+void watch_unlock_publish(void);
+
+void watch_publish(delta_kind_e kind, string_t record);
+
+int watch_subscribe(channel_t *channel, uint64_t since, wheel_timer_t *timer,
+                    unsigned timeout_ms);
+
+#endif // !WATCH_H
@@ -0,0 +1,211 @@
+#include "flow.h"
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FLOW_TABLE_INITIAL_CAPACITY 64
+#define PROBE_TABLE_INITIAL_CAPACITY 16
+
+enum probe_state { PROBE_FREE, PROBE_PENDING, PROBE_DELETED };
+
+static inline size_t hash_key(const flow_key_t *key) {
+  // FNV-1a over the bytes of the key
+  const uint8_t *bytes = (const uint8_t *)key;
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < sizeof(flow_key_t); i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Returns the direction of the packet in its flow: 0 from addr[0], 1 else
+static int make_key(const packet_t *packet, flow_key_t *key) {
+  uint16_t src_port = packet->src_port, dst_port = packet->dst_port;
+  *key = (flow_key_t){.protocol = packet->protocol};
+  if (packet->is_icmp && (packet->icmp_type == ICMP_ECHO_REQUEST ||
+                          packet->icmp_type == ICMP_ECHO_REPLY))
+    src_port = dst_port = packet->icmp_id;
+  int direction = packet->src > packet->dst ||
+                  (packet->src == packet->dst && src_port > dst_port);
+  key->addr[direction] = packet->src;
+  key->addr[!direction] = packet->dst;
+  key->port[direction] = src_port;
+  key->port[!direction] = dst_port;
+  return direction;
+}
+
+static flow_t *find_slot(flow_t *flows, size_t capacity,
+                         const flow_key_t *key) {
+  size_t mask = capacity - 1;
+  for (size_t i = hash_key(key) & mask;; i = (i + 1) & mask) {
+    if (!flows[i].used || 0 == memcmp(&flows[i].key, key, sizeof(*key)))
+      return &flows[i];
+  }
+}
+
+static int grow_flows(flow_table_t *table) {
+  size_t capacity =
+      table->capacity ? 2 * table->capacity : FLOW_TABLE_INITIAL_CAPACITY;
+  flow_t *flows = calloc(capacity, sizeof(flow_t));
+  if (flows == NULL)
+    return -1;
+  for (size_t i = 0; i < table->capacity; i++)
+    if (table->flows[i].used)
+      *find_slot(flows, capacity, &table->flows[i].key) = table->flows[i];
+  free(table->flows);
+  table->flows = flows;
+  table->capacity = capacity;
+  return 0;
+}
+
+static struct echo_probe *find_probe(struct echo_probe *probes,
+                                     size_t capacity, uint16_t seq,
+                                     int for_insert) {
+  size_t mask = capacity - 1;
+  struct echo_probe *tombstone = NULL;
+  for (size_t i = (seq * 40503u) & mask;; i = (i + 1) & mask) {
+    if (probes[i].state == PROBE_FREE)
+      return for_insert ? (tombstone ? tombstone : &probes[i]) : NULL;
+    if (probes[i].state == PROBE_DELETED) {
+      if (tombstone == NULL)
+        tombstone = &probes[i];
+    } else if (probes[i].seq == seq) {
+      return &probes[i];
+    }
+  }
+}
+
+static int grow_probes(flow_t *flow) {
+  size_t capacity = flow->probe_capacity;
+  // Only grow when live probes fill the table, else just drop tombstones
+  if (capacity == 0 || 2 * flow->probe_count >= capacity)
+    capacity = capacity ? 2 * capacity : PROBE_TABLE_INITIAL_CAPACITY;
+  struct echo_probe *probes = calloc(capacity, sizeof(struct echo_probe));
+  if (probes == NULL)
+    return -1;
+  for (size_t i = 0; i < flow->probe_capacity; i++)
+    if (flow->probes[i].state == PROBE_PENDING)
+      *find_probe(probes, capacity, flow->probes[i].seq, 1) = flow->probes[i];
+  free(flow->probes);
+  flow->probes = probes;
+  flow->probe_capacity = capacity;
+  flow->probe_deleted = 0;
+  return 0;
+}
+
+static int account_echo(flow_t *flow, const packet_t *packet) {
+  struct echo_probe *probe;
+  if (packet->icmp_type == ICMP_ECHO_REQUEST) {
+    flow->echo_requests++;
+    if (2 * (flow->probe_count + flow->probe_deleted + 1) >
+            flow->probe_capacity &&
+        0 != grow_probes(flow))
+      return -1;
+    probe = find_probe(flow->probes, flow->probe_capacity, packet->icmp_seq,
+                       1);
+    // A reused sequence number leaves the previous request unanswered
+    if (probe->state == PROBE_DELETED)
+      flow->probe_deleted--;
+    if (probe->state != PROBE_PENDING)
+      flow->probe_count++;
+    *probe = (struct echo_probe){
+        .sent = packet->time, .seq = packet->icmp_seq, .state = PROBE_PENDING};
+    return 0;
+  }
+  flow->echo_replies++;
+  probe = flow->probe_capacity ? find_probe(flow->probes, flow->probe_capacity,
+                                            packet->icmp_seq, 0)
+                               : NULL;
+  if (probe == NULL) {
+    flow->unmatched++;
+    return 0;
+  }
+  double rtt = packet->time - probe->sent;
+  probe->state = PROBE_DELETED;
+  flow->probe_count--;
+  flow->probe_deleted++;
+  if (flow->rtt_count == 0 || rtt < flow->rtt_min)
+    flow->rtt_min = rtt;
+  if (flow->rtt_count == 0 || rtt > flow->rtt_max)
+    flow->rtt_max = rtt;
+  if (flow->rtt_count > 0)
+    flow->jitter_sum += rtt > flow->last_rtt ? rtt - flow->last_rtt
+                                              : flow->last_rtt - rtt;
+  flow->last_rtt = rtt;
+  flow->rtt_sum += rtt;
+  flow->rtt_count++;
+  return 0;
+}
+
+int flow_account(flow_table_t *table, const packet_t *packet) {
+  flow_key_t key;
+  if (!packet->is_ipv4)
+    return 0;
+  // Keep the load factor under 1/2
+  if (2 * (table->count + 1) > table->capacity && 0 != grow_flows(table))
+    return -1;
+  int direction = make_key(packet, &key);
+  flow_t *flow = find_slot(table->flows, table->capacity, &key);
+  if (!flow->used) {
+    *flow = (flow_t){.key = key, .used = 1, .first_time = packet->time};
+    table->count++;
+  }
+  flow->packets[direction]++;
+  flow->bytes[direction] += packet->length;
+  flow->last_time = packet->time;
+  if (packet->is_icmp && (packet->icmp_type == ICMP_ECHO_REQUEST ||
+                          packet->icmp_type == ICMP_ECHO_REPLY))
+    return account_echo(flow, packet);
+  return 0;
+}
+
+static const char *protocol_name(uint8_t protocol) {
+  switch (protocol) {
+  case IP_PROTOCOL_ICMP:
+    return "ICMP";
+  case IP_PROTOCOL_TCP:
+    return "TCP";
+  case IP_PROTOCOL_UDP:
+    return "UDP";
+  default:
+    return "IP";
+  }
+}
+
+void flow_print(const flow_t *flow) {
+  char addr[2][INET_ADDRSTRLEN];
+  for (int i = 0; i < 2; i++) {
+    struct in_addr in = {.s_addr = htonl(flow->key.addr[i])};
+    inet_ntop(AF_INET, &in, addr[i], sizeof(addr[i]));
+  }
+  if (flow->key.protocol == IP_PROTOCOL_ICMP)
+    printf("  ICMP %s <-> %s id %hu:", addr[0], addr[1], flow->key.port[0]);
+  else
+    printf("  %s %s:%hu <-> %s:%hu:", protocol_name(flow->key.protocol),
+           addr[0], flow->key.port[0], addr[1], flow->key.port[1]);
+  printf(" %lu/%lu packets, %llu/%llu bytes, %.3f s\n", flow->packets[0],
+         flow->packets[1], flow->bytes[0], flow->bytes[1],
+         flow->last_time - flow->first_time);
+  if (flow->echo_requests == 0 && flow->echo_replies == 0)
+    return;
+  unsigned long lost = flow->echo_requests - flow->rtt_count;
+  printf("    echo: %lu requests, %lu replies (%lu unmatched), loss %.2f%%\n",
+         flow->echo_requests, flow->echo_replies, flow->unmatched,
+         flow->echo_requests ? 100.0 * lost / flow->echo_requests : 0.0);
+  if (flow->rtt_count > 0)
+    printf("    rtt (ms): min %.3f, avg %.3f, max %.3f, jitter %.3f\n",
+           flow->rtt_min * 1e3, flow->rtt_sum * 1e3 / flow->rtt_count,
+           flow->rtt_max * 1e3,
+           flow->rtt_count > 1
+               ? flow->jitter_sum * 1e3 / (flow->rtt_count - 1)
+               : 0.0);
+}
+
+void flow_table_free(flow_table_t *table) {
+  for (size_t i = 0; i < table->capacity; i++)
+    free(table->flows[i].probes);
+  free(table->flows);
+  *table = (flow_table_t){0};
+}
@@ -0,0 +1,82 @@
+#ifndef FLOW_H
+#define FLOW_H
+
+#include "pcap.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file flow.h
+ * @brief Per-flow statistics
+ * Packets are grouped in bidirectional flows keyed by their 5-tuple, or by
+ * their addresses and echo identifier for ICMP. Echo requests are paired
+ * with their reply by sequence number to measure the RTT, loss and jitter of
+ * every probe.
+ */
+
+/**
+ * @struct flow_key
+ * @brief Endpoints of a flow, the lowest address first
+ */
+struct flow_key {
+  uint32_t addr[2]; /**< IPv4 addresses, addr[0] <= addr[1] */
+  uint16_t port[2]; /**< Ports of each address, ICMP echo id in port[0] */
+  uint8_t protocol; /**< IPv4 protocol */
+  uint8_t pad[3];   /**< Always zero, keys are compared bytewise */
+};
+
+typedef struct flow_key flow_key_t;
+
+/**
+ * @struct echo_probe
+ * @brief Echo request waiting for its reply
+ */
+struct echo_probe {
+  double sent;   /**< Capture time of the request */
+  uint16_t seq;  /**< Sequence number of the request */
+  uint8_t state; /**< Slot state in the probe table */
+};
+
+/**
+ * @struct flow
+ * @brief Statistics of a flow
+ */
+struct flow {
+  flow_key_t key;                   /**< Endpoints of the flow */
+  int used;                         /**< Is the slot of the table used */
+  unsigned long packets[2];         /**< Packets sent by each address */
+  unsigned long long bytes[2];      /**< Bytes sent by each address */
+  double first_time, last_time;     /**< Times of the first/last packet */
+  unsigned long echo_requests;      /**< ICMP echo requests */
+  unsigned long echo_replies;       /**< ICMP echo replies */
+  unsigned long unmatched;          /**< Replies without a pending request */
+  unsigned long rtt_count;          /**< Requests matched with a reply */
+  double rtt_sum, rtt_min, rtt_max; /**< RTT of matched probes (seconds) */
+  double last_rtt, jitter_sum;      /**< Sum of |RTT(n) - RTT(n-1)| */
+  struct echo_probe *probes;        /**< Pending requests by sequence */
+  size_t probe_capacity;            /**< Slots of the probe table */
+  size_t probe_count;               /**< Pending probes */
+  size_t probe_deleted;             /**< Deleted slots of the probe table */
+};
+
+typedef struct flow flow_t;
+
+/**
+ * @struct flow_table
+ * @brief Open addressing hash map of flows
+ */
+struct flow_table {
+  flow_t *flows;   /**< Slots of the table */
+  size_t capacity; /**< Always a power of two */
+  size_t count;    /**< Used slots */
+};
+
+typedef struct flow_table flow_table_t;
+
+int flow_account(flow_table_t *table, const packet_t *packet);
+
+void flow_print(const flow_t *flow);
+
+void flow_table_free(flow_table_t *table);
+
+#endif // !FLOW_H
@@ -0,0 +1,159 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "pcap.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PCAP_MAGIC_MICRO 0xA1B2C3D4
+#define PCAP_MAGIC_NANO 0xA1B23C4D
+#define PCAP_HEADER_LEN 24
+#define RECORD_HEADER_LEN 16
+#define ETHERNET_HEADER_LEN 14
+#define VLAN_TAG_LEN 4
+#define ETHERTYPE_VLAN 0x8100
+#define IPV4_MIN_HEADER_LEN 20
+#define ICMP_ECHO_HEADER_LEN 8
+
+static inline uint16_t read_be16(const uint8_t *p) {
+  return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t read_be32(const uint8_t *p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 |
+         p[3];
+}
+
+static inline uint32_t read_u32(const pcap_file_t *file, const uint8_t *p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return file->swapped ? __builtin_bswap32(value) : value;
+}
+
+int pcap_open(pcap_file_t *file, const char *path) {
+  struct stat st;
+  uint32_t magic;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return -1;
+  }
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < PCAP_HEADER_LEN) {
+    fprintf(stderr, "ERROR: %s is not a pcap capture\n", path);
+    goto error;
+  }
+  file->size = st.st_size;
+  file->data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (file->data == MAP_FAILED) {
+    perror("mmap");
+    goto error;
+  }
+  // Packets are read once, in order
+  posix_madvise((void *)file->data, file->size, POSIX_MADV_SEQUENTIAL);
+  close(fd);
+
+  memcpy(&magic, file->data, sizeof(magic));
+  file->swapped = (magic == __builtin_bswap32(PCAP_MAGIC_MICRO) ||
+                   magic == __builtin_bswap32(PCAP_MAGIC_NANO));
+  magic = file->swapped ? __builtin_bswap32(magic) : magic;
+  if (magic != PCAP_MAGIC_MICRO && magic != PCAP_MAGIC_NANO) {
+    fprintf(stderr, "ERROR: %s has an unknown magic number\n", path);
+    munmap((void *)file->data, file->size);
+    return -1;
+  }
+  file->ts_divisor = (magic == PCAP_MAGIC_NANO ? 1000000000 : 1000000);
+  file->linktype = read_u32(file, file->data + 20);
+  file->offset = PCAP_HEADER_LEN;
+  return 0;
+error:
+  close(fd);
+  return -1;
+}
+
+static void decode_icmp(packet_t *packet) {
+  if (packet->protocol != IP_PROTOCOL_ICMP || packet->l4 == NULL ||
+      packet->l4_length < 4)
+    return;
+  packet->is_icmp = 1;
+  packet->icmp_type = packet->l4[0];
+  packet->icmp_code = packet->l4[1];
+  if (packet->l4_length >= ICMP_ECHO_HEADER_LEN) {
+    packet->icmp_id = read_be16(packet->l4 + 4);
+    packet->icmp_seq = read_be16(packet->l4 + 6);
+  }
+}
+
+static void decode_ports(packet_t *packet) {
+  if ((packet->protocol != IP_PROTOCOL_TCP &&
+       packet->protocol != IP_PROTOCOL_UDP) ||
+      packet->l4_length < 4)
+    return;
+  packet->src_port = read_be16(packet->l4);
+  packet->dst_port = read_be16(packet->l4 + 2);
+}
+
+static void decode_ipv4(packet_t *packet, const uint8_t *ip, size_t length) {
+  if (length < IPV4_MIN_HEADER_LEN || ip[0] >> 4 != 4)
+    return;
+  size_t header_length = (ip[0] & 0x0F) * 4;
+  packet->is_ipv4 = 1;
+  packet->ip_length = read_be16(ip + 2);
+  packet->protocol = ip[9];
+  packet->src = read_be32(ip + 12);
+  packet->dst = read_be32(ip + 16);
+  // Only the first fragment carries the transport header
+  if (header_length < IPV4_MIN_HEADER_LEN || header_length > length ||
+      (read_be16(ip + 6) & 0x1FFF) != 0)
+    return;
+  packet->l4 = ip + header_length;
+  packet->l4_length = length - header_length;
+  decode_ports(packet);
+  decode_icmp(packet);
+}
+
+static void decode_ethernet(packet_t *packet) {
+  const uint8_t *frame = packet->data;
+  size_t length = packet->length;
+  if (length < ETHERNET_HEADER_LEN)
+    return;
+  size_t offset = ETHERNET_HEADER_LEN;
+  packet->ethertype = read_be16(frame + 12);
+  if (packet->ethertype == ETHERTYPE_VLAN &&
+      length >= ETHERNET_HEADER_LEN + VLAN_TAG_LEN) {
+    packet->ethertype = read_be16(frame + 16);
+    offset += VLAN_TAG_LEN;
+  }
+  if (packet->ethertype == ETHERTYPE_IPV4)
+    decode_ipv4(packet, frame + offset, length - offset);
+}
+
+// Returns 1 when a packet was decoded, 0 at the end of the capture
+int pcap_next(pcap_file_t *file, packet_t *packet) {
+  if (file->offset + RECORD_HEADER_LEN > file->size)
+    return 0;
+  const uint8_t *record = file->data + file->offset;
+  uint32_t caplen = read_u32(file, record + 8);
+  if (caplen > file->size - file->offset - RECORD_HEADER_LEN) {
+    fprintf(stderr, "WARNING: Capture truncated at offset %zu\n",
+            file->offset);
+    return 0;
+  }
+  *packet = (packet_t){
+      .time = read_u32(file, record) +
+              (double)read_u32(file, record + 4) / file->ts_divisor,
+      .length = caplen,
+      .data = record + RECORD_HEADER_LEN,
+  };
+  file->offset += RECORD_HEADER_LEN + caplen;
+  if (file->linktype == LINKTYPE_ETHERNET)
+    decode_ethernet(packet);
+  return 1;
+}
+
+void pcap_close(pcap_file_t *file) {
+  munmap((void *)file->data, file->size);
+  *file = (pcap_file_t){0};
+}
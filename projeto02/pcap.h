@@ -0,0 +1,74 @@
+#ifndef PCAP_H
+#define PCAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file pcap.h
+ * @brief Zero-copy reader of pcap captures
+ * The capture is mapped in memory and each packet is decoded in place:
+ * the returned packet only points into the mapping.
+ */
+
+#define LINKTYPE_ETHERNET 1
+
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_ARP 0x0806
+#define ETHERTYPE_IPV6 0x86DD
+
+#define IP_PROTOCOL_ICMP 1
+#define IP_PROTOCOL_TCP 6
+#define IP_PROTOCOL_UDP 17
+
+#define ICMP_ECHO_REPLY 0
+#define ICMP_ECHO_REQUEST 8
+
+/**
+ * @struct pcap_file
+ * @brief A capture mapped in memory
+ */
+struct pcap_file {
+  const uint8_t *data; /**< Start of the mapping */
+  size_t size;         /**< Size of the mapping */
+  size_t offset;       /**< Offset of the next record */
+  int swapped;         /**< Was the capture written in the other byte order */
+  uint32_t ts_divisor; /**< Sub-second timestamp units per second */
+  uint32_t linktype;   /**< Link layer of the packets */
+};
+
+typedef struct pcap_file pcap_file_t;
+
+/**
+ * @struct packet
+ * @brief Decoded headers of a packet, pointing into the capture
+ */
+struct packet {
+  double time;          /**< Capture timestamp in seconds */
+  uint32_t length;      /**< Captured length */
+  const uint8_t *data;  /**< Captured bytes */
+  uint16_t ethertype;   /**< 0 when not an Ethernet frame */
+  int is_ipv4;          /**< Are the IPv4 fields valid */
+  uint32_t src, dst;    /**< IPv4 addresses in host order */
+  uint8_t protocol;     /**< IPv4 protocol */
+  uint16_t ip_length;   /**< IPv4 total length */
+  const uint8_t *l4;    /**< Transport header, NULL when truncated */
+  size_t l4_length;     /**< Captured bytes from the transport header */
+  uint16_t src_port;    /**< TCP or UDP source port */
+  uint16_t dst_port;    /**< TCP or UDP destination port */
+  int is_icmp;          /**< Are the ICMP fields valid */
+  uint8_t icmp_type;    /**< ICMP type */
+  uint8_t icmp_code;    /**< ICMP code */
+  uint16_t icmp_id;     /**< Echo identifier */
+  uint16_t icmp_seq;    /**< Echo sequence number */
+};
+
+typedef struct packet packet_t;
+
+int pcap_open(pcap_file_t *file, const char *path);
+
+int pcap_next(pcap_file_t *file, packet_t *packet);
+
+void pcap_close(pcap_file_t *file);
+
+#endif // !PCAP_H
@@ -0,0 +1,328 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "flow.h"
+#include "pcap.h"
+#include <arpa/inet.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Single pass analysis of pcap captures, one thread per capture.
+ * For each capture, prints the same metrics as the former scapy script, the
+ * statistics of each flow and, with -o, writes the per-packet time series
+ * used by the plots to <dir>/<capture>.csv. The throughput series is
+ * averaged over a sliding window of -w seconds.
+ */
+
+#define IP_SET_INITIAL_CAPACITY 64
+#define WINDOW_INITIAL_CAPACITY 256
+
+/**
+ * @struct ip_set
+ * @brief Open addressing set of IPv4 addresses
+ */
+struct ip_set {
+  uint64_t *slots; /**< Addresses plus one, 0 marks a free slot */
+  size_t capacity; /**< Always a power of two */
+  size_t count;    /**< Addresses in the set */
+};
+
+typedef struct ip_set ip_set_t;
+
+struct metrics {
+  unsigned long total_packets;
+  unsigned long icmp_packets;
+  unsigned long ipv4_packets, arp_packets, ipv6_packets, other_packets;
+  unsigned long echo_requests, echo_replies;
+  unsigned long long total_bytes;
+  double first_time, last_time;
+  ip_set_t src_ips, dst_ips;
+  flow_table_t flows;
+};
+
+struct window_packet {
+  double time;
+  uint32_t length;
+};
+
+/**
+ * @struct window
+ * @brief Packets captured during the last window_s seconds
+ */
+struct window {
+  struct window_packet *packets; /**< Circular buffer of packets */
+  size_t capacity;               /**< Always a power of two */
+  size_t head, count;            /**< Oldest packet and number of packets */
+  unsigned long long bytes;      /**< Bytes of the packets in the window */
+};
+
+struct analysis {
+  const char *capture;
+  FILE *csv;
+  struct metrics metrics;
+  int status;
+  pthread_t thread;
+};
+
+static double window_s = 1.0;
+
+static inline size_t hash_ip(uint32_t ip) {
+  return (size_t)(ip * UINT32_C(2654435761));
+}
+
+static int ip_set_add(ip_set_t *set, uint32_t ip);
+
+static int ip_set_grow(ip_set_t *set) {
+  ip_set_t grown = {
+      .capacity = set->capacity ? set->capacity * 2 : IP_SET_INITIAL_CAPACITY};
+  grown.slots = calloc(grown.capacity, sizeof(uint64_t));
+  if (grown.slots == NULL)
+    return -1;
+  for (size_t i = 0; i < set->capacity; i++)
+    if (set->slots[i] != 0)
+      ip_set_add(&grown, (uint32_t)(set->slots[i] - 1));
+  free(set->slots);
+  *set = grown;
+  return 0;
+}
+
+static int ip_set_add(ip_set_t *set, uint32_t ip) {
+  // Keep the load factor under 1/2
+  if (2 * (set->count + 1) > set->capacity && 0 != ip_set_grow(set))
+    return -1;
+  uint64_t key = (uint64_t)ip + 1;
+  size_t mask = set->capacity - 1;
+  for (size_t i = hash_ip(ip) & mask;; i = (i + 1) & mask) {
+    if (set->slots[i] == key)
+      return 0;
+    if (set->slots[i] == 0) {
+      set->slots[i] = key;
+      set->count++;
+      return 0;
+    }
+  }
+}
+
+static void ip_set_print(const char *label, const ip_set_t *set) {
+  char text[INET_ADDRSTRLEN];
+  const char *sep = "";
+  printf("%s", label);
+  for (size_t i = 0; i < set->capacity; i++) {
+    if (set->slots[i] == 0)
+      continue;
+    struct in_addr addr = {.s_addr = htonl((uint32_t)(set->slots[i] - 1))};
+    printf("%s%s", sep, inet_ntop(AF_INET, &addr, text, sizeof(text)));
+    sep = ", ";
+  }
+  printf("\n");
+}
+
+// Slide the window to end at the packet and return the throughput over it
+static double window_slide(struct window *w, const packet_t *packet) {
+  size_t mask = w->capacity - 1;
+  while (w->count > 0 && w->packets[w->head].time <= packet->time - window_s) {
+    w->bytes -= w->packets[w->head].length;
+    w->head = (w->head + 1) & mask;
+    w->count--;
+  }
+  if (w->count == w->capacity) {
+    size_t capacity = w->capacity ? 2 * w->capacity : WINDOW_INITIAL_CAPACITY;
+    struct window_packet *packets =
+        malloc(capacity * sizeof(struct window_packet));
+    if (packets == NULL)
+      return w->bytes / window_s;
+    for (size_t i = 0; i < w->count; i++)
+      packets[i] = w->packets[(w->head + i) & mask];
+    free(w->packets);
+    w->packets = packets;
+    w->capacity = capacity;
+    w->head = 0;
+    mask = capacity - 1;
+  }
+  w->packets[(w->head + w->count++) & mask] =
+      (struct window_packet){packet->time, packet->length};
+  w->bytes += packet->length;
+  return w->bytes / window_s;
+}
+
+static FILE *open_csv(const char *dir, const char *capture) {
+  char path[4096];
+  char *copy = strdup(capture);
+  if (copy == NULL)
+    return NULL;
+  char *name = basename(copy);
+  char *extension = strrchr(name, '.');
+  if (extension != NULL)
+    *extension = '\0';
+  snprintf(path, sizeof(path), "%s/%s.csv", dir, name);
+  free(copy);
+  FILE *csv = fopen(path, "w");
+  if (csv == NULL) {
+    perror(path);
+    return NULL;
+  }
+  fprintf(csv, "time,interval,throughput,cumulative_ip_bytes\n");
+  return csv;
+}
+
+static int analyze(const char *capture, struct metrics *m, FILE *csv) {
+  pcap_file_t file;
+  packet_t packet;
+  struct window window = {0};
+  double previous = 0;
+  unsigned long long ip_bytes = 0;
+  if (0 != pcap_open(&file, capture))
+    return -1;
+  while (pcap_next(&file, &packet)) {
+    if (m->total_packets == 0)
+      m->first_time = previous = packet.time;
+    m->total_packets++;
+    m->total_bytes += packet.length;
+    m->last_time = packet.time;
+
+    switch (packet.ethertype) {
+    case ETHERTYPE_IPV4:
+      m->ipv4_packets++;
+      break;
+    case ETHERTYPE_ARP:
+      m->arp_packets++;
+      break;
+    case ETHERTYPE_IPV6:
+      m->ipv6_packets++;
+      break;
+    default:
+      m->other_packets++;
+      break;
+    }
+    if (packet.is_ipv4) {
+      ip_set_add(&m->src_ips, packet.src);
+      ip_set_add(&m->dst_ips, packet.dst);
+      ip_bytes += packet.length;
+    }
+    if (0 != flow_account(&m->flows, &packet)) {
+      fprintf(stderr, "ERROR: Failed to allocate the flow table\n");
+      break;
+    }
+    if (packet.is_icmp) {
+      m->icmp_packets++;
+      if (packet.icmp_type == ICMP_ECHO_REQUEST)
+        m->echo_requests++;
+      else if (packet.icmp_type == ICMP_ECHO_REPLY)
+        m->echo_replies++;
+    }
+    if (csv != NULL)
+      fprintf(csv, "%.6f,%.6f,%.2f,%llu\n", packet.time - m->first_time,
+              packet.time - previous, window_slide(&window, &packet),
+              ip_bytes);
+    previous = packet.time;
+  }
+  free(window.packets);
+  pcap_close(&file);
+  return 0;
+}
+
+static void *run_analysis(void *arg) {
+  struct analysis *analysis = arg;
+  analysis->status =
+      analyze(analysis->capture, &analysis->metrics, analysis->csv);
+  return NULL;
+}
+
+static void print_metrics(const char *capture, const struct metrics *m) {
+  double duration = m->last_time - m->first_time;
+  unsigned long matched = 0;
+  for (size_t i = 0; i < m->flows.capacity; i++)
+    matched += m->flows.flows[i].rtt_count;
+  unsigned long lost = m->echo_requests - matched;
+  printf("\nAnalysis of %s:\n", capture);
+  printf("Total packets: %lu\n", m->total_packets);
+  printf("Total ICMP packets: %lu\n", m->icmp_packets);
+  ip_set_print("Unique source IPs: ", &m->src_ips);
+  ip_set_print("Unique destination IPs: ", &m->dst_ips);
+  printf("Average throughput (bytes/s): %.2f\n",
+         duration > 0 ? m->total_bytes / duration : 0.0);
+  printf("Average packet interval (s): %.2f\n",
+         m->total_packets > 1 ? duration / (m->total_packets - 1) : 0.0);
+  printf("Packet types captured: IPv4: %lu, ARP: %lu, IPv6: %lu, other: %lu\n",
+         m->ipv4_packets, m->arp_packets, m->ipv6_packets, m->other_packets);
+  printf("ICMP Echo Requests: %lu\n", m->echo_requests);
+  printf("ICMP Echo Replies: %lu\n", m->echo_replies);
+  printf("ICMP Packet Loss (%%): %.2f%%\n",
+         m->echo_requests > 0 ? 100.0 * lost / m->echo_requests : 0.0);
+  printf("Flows: %zu\n", m->flows.count);
+  for (size_t i = 0; i < m->flows.capacity; i++)
+    if (m->flows.flows[i].used)
+      flow_print(&m->flows.flows[i]);
+}
+
+int main(int argc, char *argv[]) {
+  const char *csv_dir = NULL;
+  char *endptr;
+  int opt, status = EXIT_SUCCESS;
+  while (-1 != (opt = getopt(argc, argv, "o:w:"))) {
+    switch (opt) {
+    case 'o':
+      csv_dir = optarg;
+      break;
+    case 'w':
+      window_s = strtod(optarg, &endptr);
+      if (*endptr != '\0' || !(window_s > 0))
+        goto usage;
+      break;
+    default:
+      goto usage;
+    }
+  }
+  if (optind >= argc)
+    goto usage;
+
+  // Analyze every capture in its own thread
+  int count = argc - optind;
+  struct analysis *analyses = calloc(count, sizeof(struct analysis));
+  if (analyses == NULL) {
+    fprintf(stderr, "ERROR: Failed to allocate the analyses\n");
+    return EXIT_FAILURE;
+  }
+  for (int i = 0; i < count; i++) {
+    struct analysis *analysis = &analyses[i];
+    analysis->capture = argv[optind + i];
+    analysis->status = -1;
+    if (csv_dir != NULL &&
+        NULL == (analysis->csv = open_csv(csv_dir, analysis->capture)))
+      continue;
+    if (0 != pthread_create(&analysis->thread, NULL, run_analysis, analysis)) {
+      fprintf(stderr, "ERROR: Failed to start the analysis of %s\n",
+              analysis->capture);
+      analysis->thread = 0;
+    }
+  }
+  // Print the results in the order of the command line
+  for (int i = 0; i < count; i++) {
+    struct analysis *analysis = &analyses[i];
+    if (analysis->thread != 0)
+      pthread_join(analysis->thread, NULL);
+    if (analysis->status == 0)
+      print_metrics(analysis->capture, &analysis->metrics);
+    else
+      status = EXIT_FAILURE;
+    if (analysis->csv != NULL)
+      fclose(analysis->csv);
+    free(analysis->metrics.src_ips.slots);
+    free(analysis->metrics.dst_ips.slots);
+    flow_table_free(&analysis->metrics.flows);
+  }
+  free(analyses);
+  return status;
+
+usage:
+  fprintf(stderr,
+          "Usage: %s [-o csv directory] [-w throughput window (s)] "
+          "capture.pcap...\n",
+          argv[0]);
+  return EXIT_FAILURE;
+}